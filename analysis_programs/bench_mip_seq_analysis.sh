@@ -0,0 +1,52 @@
+#!/usr/bin/env bash
+
+#Xander Nuttle
+#bench_mip_seq_analysis.sh
+#Call: bash /data/talkowski/xander/MIPs/analysis_programs/bench_mip_seq_analysis.sh reference_mip_seq_analysis_program test_mip_seq_analysis_program miptargets_file gzipped_sam_file(s)
+#
+#Runs two builds of mip_seq_analysis (e.g., the installed program and a newly compiled one) on the same gzipped sam files, such as the
+#mapping output files of an experiment, and checks that both generate identical mipseqs output for every file. Reports the number of reads
+#processed per second by each build for each file and overall. Exits with status 1 if the output of the two builds differs for any file.
+
+REF_PROG=$(readlink -f $1)
+TEST_PROG=$(readlink -f $2)
+MTARGS=$(readlink -f $3)
+shift 3
+WORK_DIR=$(mktemp -d)
+mkdir $WORK_DIR/ref $WORK_DIR/test
+
+nfail=0
+allreads=0
+reftime=0
+testtime=0
+echo -e "File\tReads\tRef_reads_per_sec\tTest_reads_per_sec\tOutput"
+for file in "$@"; do
+	SAM_NAME=$(basename $file)
+	SAMP_NAME=${SAM_NAME%%.*}
+	ln -sf $(readlink -f $file) $WORK_DIR/ref/$SAM_NAME
+	ln -sf $(readlink -f $file) $WORK_DIR/test/$SAM_NAME
+	nreads=$(zcat $file|wc -l)
+	start=$(date +%s.%N)
+	(cd $WORK_DIR/ref && $REF_PROG $SAM_NAME $MTARGS)
+	mid=$(date +%s.%N)
+	(cd $WORK_DIR/test && $TEST_PROG $SAM_NAME $MTARGS)
+	end=$(date +%s.%N)
+	rtime=$(awk -v a=$start -v b=$mid 'BEGIN{print b-a}')
+	ttime=$(awk -v a=$mid -v b=$end 'BEGIN{print b-a}')
+	if cmp -s <(zcat $WORK_DIR/ref/${SAMP_NAME}.mipseqs.gz) <(zcat $WORK_DIR/test/${SAMP_NAME}.mipseqs.gz); then
+		status=identical
+	else
+		status=DIFFERENT
+		nfail=$((nfail+1))
+	fi
+	awk -v f=$SAM_NAME -v n=$nreads -v r=$rtime -v t=$ttime -v s=$status 'BEGIN{printf "%s\t%d\t%.0f\t%.0f\t%s\n",f,n,n/r,n/t,s}'
+	allreads=$((allreads+nreads))
+	reftime=$(awk -v a=$reftime -v b=$rtime 'BEGIN{print a+b}')
+	testtime=$(awk -v a=$testtime -v b=$ttime 'BEGIN{print a+b}')
+	rm -f $WORK_DIR/ref/* $WORK_DIR/test/*
+done
+awk -v n=$allreads -v r=$reftime -v t=$testtime -v d=$nfail 'BEGIN{printf "Total\t%d\t%.0f\t%.0f\t%d_files_differ\n",n,n/r,n/t,d}'
+rm -r $WORK_DIR
+if [ $nfail -gt 0 ]; then
+	exit 1
+fi
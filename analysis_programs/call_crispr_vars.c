@@ -16,6 +16,7 @@
 #include<string.h>
 #include<stdlib.h>
 #include<ctype.h>
+#include<stddef.h>
 #include<zlib.h>
 #define NLEN 200 //size of character vectors for storing names, etc.
 #define SLEN 500 //maximum length of each sequence array (and corresponding quality array)
@@ -48,6 +49,16 @@ struct coordtable
 	long chrcoord;
 };
 
+//set up structure to store a hash table of names for fast lookup; the table holds indices into an array of records, each of which stores
+//its name at the same offset from the start of the record
+struct nameindex
+{
+	long*ids;
+	long size;
+	char*names; //name of the first record
+	long stride; //size of each record
+};
+
 //set up structure to store data for each input sequence
 struct input
 {
@@ -69,10 +80,10 @@ void get_vars(FILE*vars,struct pevariant*pvars);
 long count_contigs(FILE*cconvert);
 void get_coords(FILE*cconvert,struct coordtable*cdata);
 int getinput(gzFile*fseqs,struct input*iseq);
-void process(struct input*iseq,struct edit*edata,long numedits,struct pevariant*pvars,long numvars,long flank,struct coordtable*cdata,long numcontigs);
-long findedit(char*ename,struct edit*editdata,long ncrispr);
-long findvar(char*vname,struct pevariant*variants,long nvariants);
-long findcontig(char*cname,struct coordtable*ctigs,long nctigs);
+void process(struct input*iseq,struct edit*edata,struct nameindex*eindex,struct pevariant*pvars,struct nameindex*vindex,long flank,struct coordtable*cdata,struct nameindex*cindex);
+void build_nameindex(struct nameindex*index,char*names,long stride,long numnames);
+unsigned long hash_name(char*name);
+long findname(char*name,struct nameindex*index);
 void clearseqs(char*rseq,char*aseq,char*rseg,char*aseg,char*rlflk,char*alflk,char*rrflk,char*arflk);
 void clearcoords(long*coords);
 void parse_cs(char*cs,char*refaln,char*altaln,long coord,long*coordaln);
@@ -121,18 +132,27 @@ int main(int argc,char*argv[])
 		get_coords(ctable,contigs);
 	}
 
+	//index CRISPR edit names, prime editing variant names, and contig names for fast lookup
+	struct nameindex editindex,varindex,contigindex;
+	build_nameindex(&editindex,(char*)edits+offsetof(struct edit,name),sizeof(struct edit),nedits);
+	build_nameindex(&varindex,(char*)pevars+offsetof(struct pevariant,name),sizeof(struct pevariant),nvars);
+	build_nameindex(&contigindex,(char*)contigs+offsetof(struct coordtable,contig),sizeof(struct coordtable),ncontigs);
+
 	//read in final called MIP sequences and process them one by one
 	gzFile*finalseqs=gzopen(*(argv+1),"r");
 	struct input inseq;
 	getinput(finalseqs,&inseq); //process header line
 	while(getinput(finalseqs,&inseq))
-		process(&inseq,edits,nedits,pevars,nvars,nflk,contigs,ncontigs);
+		process(&inseq,edits,&editindex,pevars,&varindex,nflk,contigs,&contigindex);
 	
 	//print status for each genotype CRISPR edit
 	print_data(sample,edits,nedits);
 	
 	//clean up and exit
 	free(edits);
+	free(editindex.ids);
+	free(varindex.ids);
+	free(contigindex.ids);
 	gzclose(finalseqs);
 	fclose(editlist);
 	if(primevars)
@@ -217,7 +237,7 @@ int getinput(gzFile*fseqs,struct input*iseq)
 	return (scanned==9);
 }
 
-void process(struct input*iseq,struct edit*edata,long numedits,struct pevariant*pvars,long numvars,long flank,struct coordtable*cdata,long numcontigs)
+void process(struct input*iseq,struct edit*edata,struct nameindex*eindex,struct pevariant*pvars,struct nameindex*vindex,long flank,struct coordtable*cdata,struct nameindex*cindex)
 {
 	char*cr;
 	char edit[NLEN+1];
@@ -232,13 +252,13 @@ void process(struct input*iseq,struct edit*edata,long numedits,struct pevariant*
 			cr=strtok(NULL,"/");
 			continue;
 		}
-		e=findedit(cr,edata,numedits);
+		e=findname(cr,eindex);
 		if(e==-1)
 		{
 			cr=strtok(NULL,"/");
 			continue;
 		}
-		v=findvar(cr,pvars,numvars);
+		v=findname(cr,vindex);
 		if(v==-1)
 		{
 			if(strpbrk(iseq->seq,"+-")!=NULL)
@@ -251,7 +271,7 @@ void process(struct input*iseq,struct edit*edata,long numedits,struct pevariant*
 			cr=strtok(NULL,"/");
 			continue;
 		}
-		c=findcontig(iseq->contig,cdata,numcontigs);
+		c=findname(iseq->contig,cindex);
 		chrloc=(iseq->maploc)+cdata[c].chrcoord-1;
 		clearseqs(refseq,altseq,refseg,altseg,reflflk,altlflk,refrflk,altrflk);
 		clearcoords(refcoord);
@@ -281,35 +301,49 @@ void process(struct input*iseq,struct edit*edata,long numedits,struct pevariant*
 	return;
 }
 
-long findedit(char*ename,struct edit*editdata,long ncrispr)
+void build_nameindex(struct nameindex*index,char*names,long stride,long numnames)
 {
-	long ed;
-	for(ed=0;ed<ncrispr;ed++)
+	long n,slot;
+	index->size=1;
+	while(index->size<2*numnames) //keep the table at most half full so probe sequences stay short
+		index->size*=2;
+	index->ids=(long*)malloc(index->size*sizeof(long));
+	index->names=names;
+	index->stride=stride;
+	for(slot=0;slot<index->size;slot++)
+		index->ids[slot]=-1;
+	for(n=0;n<numnames;n++)
 	{
-		if(strncmp(editdata[ed].name,ename,NLEN)==0)
-			return ed;
+		if(findname(names+n*stride,index)!=-1) //if a name is listed more than once, lookups return the first record with that name
+			continue;
+		slot=hash_name(names+n*stride)&(index->size-1);
+		while(index->ids[slot]!=-1)
+			slot=(slot+1)&(index->size-1);
+		index->ids[slot]=n;
 	}
-	return -1;
+	return;
 }
 
-long findvar(char*vname,struct pevariant*variants,long nvariants)
+unsigned long hash_name(char*name)
 {
-	long vnum;
-	for(vnum=0;vnum<nvariants;vnum++)
+	unsigned long h=14695981039346656037UL; //FNV-1a hash
+	long i;
+	for(i=0;(i<NLEN)&&(name[i]!='\0');i++)
 	{
-		if(strncmp(variants[vnum].name,vname,NLEN)==0)
-			return vnum;
+		h^=(unsigned char)name[i];
+		h*=1099511628211UL;
 	}
-	return -1;
+	return h;
 }
 
-long findcontig(char*cname,struct coordtable*ctigs,long nctigs)
+long findname(char*name,struct nameindex*index)
 {
-	long cnum;
-	for(cnum=0;cnum<nctigs;cnum++)
+	long slot=hash_name(name)&(index->size-1);
+	while(index->ids[slot]!=-1)
 	{
-		if(strncmp(ctigs[cnum].contig,cname,NLEN)==0)
-			return cnum;
+		if(strncmp(index->names+index->ids[slot]*index->stride,name,NLEN)==0)
+			return index->ids[slot];
+		slot=(slot+1)&(index->size-1);
 	}
 	return -1;
 }
@@ -1,15 +1,33 @@
 //Xander Nuttle
 //call_mip_hapcn.c
-//Call: ./call_mip_hapcn miptargets_file mipcounts_file (long)max_hapcn
+//Call: ./call_mip_hapcn miptargets_file mipcounts_file (long)max_hapcn <(int)num_threads>
+//  or: ./call_mip_hapcn experiment.mipcounts contig_name (long)max_hapcn <(int)num_threads>
 //
 //The miptargets file input must be in format v3 (where MIPs have letter-based specificities).
+//
+//In the second (batch) form, which is used when the first argument is a mipcounts file, all individuals in an experiment-wide mipcounts file
+//(e.g., as combined by mrmip_pb9_dm_fastq.sh) are genotyped at the named contig in one run. Each individual's MIP targets are that individual's lines
+//for the contig (in file order, with target coordinates taken from the Coordinate column), and each MIP is treated as distinguishing every haplotype.
+//Output files are named after the mipcounts file and the contig (e.g., experiment_contig.cncalls, experiment_contig.compevents, and
+//experiment_contig.simplecalls) and are written to the current directory.
+//
+//The mipcounts file is read into memory once, and individuals are genotyped in parallel by a pool of worker threads, each with its own likelihood graph.
+//The optional numeric argument sets the number of worker threads (default: the number of online processors). Results are printed in the order in which
+//individuals appear in the mipcounts file, so output does not depend on the number of threads.
+//
+//Log-factorials are computed with GSL by default. To build without GSL, compile with -DNO_GSL, which uses the C library's lgamma_r instead (log-likelihoods
+//may then differ from those of GSL builds in the last few digits).
+//
+//All tables whose size depends on the number of paralogs or copy number states are allocated on the heap, so larger paralog families and higher
+//maximum copy numbers are limited by memory rather than stack size. Copy numbers are stored as single bytes, so max_hapcn must be at most 255.
 
 #include<stdio.h>
 #include<string.h>
-#include<gsl/gsl_randist.h>
 #include<float.h>
 #include<math.h>
 #include<stdlib.h>
+#include<pthread.h>
+#include<unistd.h>
 #define KRED "\x1B[31m"
 #define KYEL "\x1B[33m"
 #define L_PRIOR -7.5 //log likelihood increment for each copy difference from copy number 1 (used in calculating prior probabilities for each possible copy number state)
@@ -17,6 +35,15 @@
 #define L_LRT 40.0 //minimum difference in log-likelihoods between a path with more copy number states and a path with fewer copy number states for caller to consider the former path
 #define M_MIN 5 //minimum number of MIPs in each copy number state for caller to consider a path having multiple copy number states
 #define LOD_MAX 1000.0 //maximum value of LOD score used to quantify how much more likely the maximally likely 0-transition path is than the next most likely such path
+#define NLEN 101 //maximum length of individual names + 1
+#define ALIGN 64 //alignment in bytes of heap-allocated tables (a cache line, which also suits vector loads and stores)
+#ifdef NO_GSL
+#define LNFACT(n) ln_fact(n)
+double ln_fact(unsigned int n);
+#else
+#include<gsl/gsl_sf_gamma.h>
+#define LNFACT(n) gsl_sf_lnfact(n)
+#endif
 
 //set up node structure for dynamic programming to find maximum likelihood path through graph
 //allow detection of two copy number transitions across spatial extent of targeted sequence (e.g., to detect an internal duplication, deletion, or interlocus gene conversion signature)
@@ -30,91 +57,196 @@ struct node
 	struct node*path_2t;
 };
 
+//set up structure to store, for each copy number state, the list of copy number states from which a valid transition can be made (in ascending order)
+struct translist
+{
+	long*start; //index in preds of the first valid predecessor for each copy number state (with one extra entry marking the end of the list for the last state)
+	long*preds;
+};
+
+//set up structure to store an individual's MIP read counts and the genotype information inferred from them
+struct indiv
+{
+	char name[NLEN];
+	unsigned int*counts; //raw counts for each MIP (in miptargets file order) and each paralog
+	long nummips;
+	long maxmips;
+	long*coords; //target coordinate of each MIP
+	double max0;
+	double nextmax0;
+	double max1;
+	double max2;
+	long imax0;
+	long states[3];
+	long tmips[2];
+	int num_trans;
+};
+
+//set up structure to store data shared by the worker threads genotyping individuals
+struct cnjob
+{
+	struct indiv*indivs;
+	long nindivs;
+	long next; //index of the next individual to be genotyped
+	pthread_mutex_t lock;
+	long numseqs;
+	long nummips; //maximum number of MIPs for any individual
+	long numstates;
+	char*specvecs;
+	long*specids; //index of each MIP's specificity in logprobs
+	double*logprobs;
+	double*priorvec;
+	struct translist*trans;
+};
+
 void count_targets(FILE*miptargs,long*nummips,long*numseqs);
 void get_mip_info(FILE*miptargs,long nummips,long speclength,long targlocs[nummips],char specvecs[nummips][speclength]);
-void set_priors(long numseqs,long parastates,long numstates,double priorvec[numstates],long cstates[numstates][numseqs]);
+void*alloc_table(long n,size_t size);
+void set_priors(long numseqs,long parastates,long numstates,double priorvec[numstates],unsigned char cstates[numstates][numseqs],long copynums[numstates]);
+void build_transitions(long numseqs,long parastates,long numstates,unsigned char cnstates[numstates][numseqs],long copynums[numstates],struct translist*trans);
+int compare_states(const void*p1,const void*p2);
 void init_output(FILE*outfiles[3],char*base,long numseqs);
+long get_indivs(FILE*mcounts,long numseqs,long nummips,long*targlocs,struct indiv**indivs);
+long count_columns(FILE*mcounts);
+void set_specs(long nummips,long speclength,char specvecs[nummips][speclength]);
+long get_contig_indivs(FILE*mcounts,char*contig,long numseqs,struct indiv**indivs);
+void*genotype(void*arg);
 void init_graph(struct node*graph,long nummips,long numstates);
-void fill_graph(struct node*graph,FILE*mcounts,long numseqs,long nummips,long numstates,long speclength,char specvecs[nummips][speclength],long cnstates[numstates][numseqs]);
+double*build_logprobs(long numseqs,long nummips,long numstates,long speclength,char specvecs[nummips][speclength],unsigned char cnstates[numstates][numseqs],long copynums[numstates],long*specids);
+void fill_graph(struct node*graph,unsigned int*mcounts,long numseqs,long nummips,long numstates,long speclength,char specvecs[nummips][speclength],long*specids,double*logprobs,unsigned int*rawcounts,unsigned int*counts,double*likelihoods);
 void init_counts(long nseqs,unsigned int rcounts[nseqs],unsigned int fcounts[nseqs]);
 void init_probs(long nseqs,double pvec[nseqs]);
-long num_copies(long state,long nseqs,long nstates,long copystates[nstates][nseqs]);
-void parse_graph(struct node*graph,long numseqs,long nummips,long numstates,double priorvec[numstates],long cnstates[numstates][numseqs]);
-double segmax(struct node*lgraph,long index,long nseqs,long nstates,long copystates[nstates][nseqs],int path);
-int trans_good(long index,long index2,long n_states,long n_seqs,long pscn_states[n_states][n_seqs]);
+void parse_graph(struct node*graph,long nummips,long numstates,double priorvec[numstates],struct translist*trans);
+double segmax(struct node*lgraph,long index,long nstates,struct translist*trans,double layermax,int path);
 void get_path_maxes(struct node*lgraph,long nmips,long nstates,double*m0,double*nm0,double*m1,double*m2,long*im0,long*im1,long*im2);
 int diff_support(struct node*lgraph,long index,long index2,long nstates);
 int assess_path(struct node*lgraph,double m0,double m1,double m2,long im1,long im2,long nmips,long nstates,long*cnstates,long*edgemips,int path);
 int imax(int i1,int i2);
 double dmax(double d1,double d2);
-void print_output(FILE*outfiles[3],char*individual,double m0,double nm0,double m1,double m2,long im0,int ntrans,long*cnstates,long*edgemips,long nummips,long targlocs[nummips],long nstates,long nseqs,long copystates[nstates][nseqs]);
+void print_output(FILE*outfiles[3],char*individual,double m0,double nm0,double m1,double m2,long im0,int ntrans,long*cnstates,long*edgemips,long*targlocs,long nstates,long nseqs,unsigned char copystates[nstates][nseqs]);
 double dmin(double d1,double d2);
-void print_pscn(FILE*out,long state,long n_states,long n_seqs,long pscn_states[n_states][n_seqs]);
+void print_pscn(FILE*out,long state,long n_states,long n_seqs,unsigned char pscn_states[n_states][n_seqs]);
 
 int main(int argc,char*argv[])
 {
-  //determine the number of MIP targets and the number of distinct paralogs
-  FILE*miptargets=fopen(*(argv+1),"r");
-	long num_mip_targets=0,num_plogs=0;
-	count_targets(miptargets,&num_mip_targets,&num_plogs);
+  //determine the number of MIP targets and the number of distinct paralogs; in batch mode, read in paralog-specific MIP read counts and target
+	//coordinates for all individuals with data at the contig, and use the largest number of MIP targets for any individual
+	int batch=(strstr(*(argv+1),".mipcounts")!=NULL);
+	FILE*miptargets=NULL,*mipcounts=NULL;
+	struct indiv*indivs;
+	long num_mip_targets=0,num_plogs=0,num_indivs=0,i;
+	if(batch)
+	{
+		mipcounts=fopen(*(argv+1),"r");
+		num_plogs=count_columns(mipcounts)-4; //columns after the sample name, contig, coordinate, and MIP type hold paralog-specific counts
+		num_indivs=get_contig_indivs(mipcounts,*(argv+2),num_plogs,&indivs);
+		for(i=0;i<num_indivs;i++)
+		{
+			if(indivs[i].nummips>num_mip_targets)
+				num_mip_targets=indivs[i].nummips;
+		}
+	}
+	else
+	{
+		miptargets=fopen(*(argv+1),"r");
+		count_targets(miptargets,&num_mip_targets,&num_plogs);
+	}
 
-	//read in MIP specificities and target coordinates
-	long coords[num_mip_targets];
-	char specs[num_mip_targets][num_plogs+1];
-	get_mip_info(miptargets,num_mip_targets,num_plogs+1,coords,specs);
+	//read in MIP specificities and target coordinates (in batch mode, each individual's target coordinates were read in with its counts)
+	long*coords=NULL;
+	char(*specs)[num_plogs+1]=alloc_table(num_mip_targets,num_plogs+1);
+	if(batch)
+		set_specs(num_mip_targets,num_plogs+1,specs);
+	else
+	{
+		coords=(long*)alloc_table(num_mip_targets,sizeof(long));
+		get_mip_info(miptargets,num_mip_targets,num_plogs+1,coords,specs);
+	}
 
 	//set up vectors of copy number states and corresponding prior probabilities
 	long para_cstates=strtol(*(argv+3),NULL,10)+1; //number of possible copy number states for each paralog
+	if((para_cstates<1)||(para_cstates>256))
+	{
+		printf(KRED "%s must be between 0 and 255.\n","max_hapcn");
+		exit(1);
+	}
 	long num_cstates=pow(para_cstates,num_plogs);
-	double priors[num_cstates];
-	long copy_states[num_cstates][num_plogs];
-	set_priors(num_plogs,para_cstates,num_cstates,priors,copy_states);
-
-	//allocate storage for likelihood graph
-	struct node*likelihood_graph;
-  likelihood_graph=(struct node*)malloc(num_mip_targets*num_cstates*sizeof(struct node));
-
-	//set up output files
-	char basename[101];
+	double*priors=(double*)alloc_table(num_cstates,sizeof(double));
+	unsigned char(*copy_states)[num_plogs]=alloc_table(num_cstates,num_plogs); //copy number of each paralog under each state
+	long*copy_nums=(long*)alloc_table(num_cstates,sizeof(long)); //total copy number under each state
+	set_priors(num_plogs,para_cstates,num_cstates,priors,copy_states,copy_nums);
+
+	//list valid copy number state transitions once so the dynamic programming only visits valid predecessors of each state
+	struct translist transitions;
+	build_transitions(num_plogs,para_cstates,num_cstates,copy_states,copy_nums,&transitions);
+
+	//cache log-probabilities of observing each distinguishable sequence under each copy number state for each distinct MIP specificity
+	long*spec_ids=(long*)alloc_table(num_mip_targets,sizeof(long));
+	double*log_probs=build_logprobs(num_plogs,num_mip_targets,num_cstates,num_plogs+1,specs,copy_states,copy_nums,spec_ids);
+
+	//set up output files, named after the mipcounts file without its extension (in batch mode, also without its directory and followed by the contig name)
+	char*mcname=*(argv+(batch?1:2));
+	if((batch)&&(strrchr(mcname,'/')!=NULL))
+		mcname=strrchr(mcname,'/')+1;
+	char basename[strlen(mcname)+strlen(*(argv+2))+2];
+	strcpy(basename,mcname);
+	char*extension=strrchr(basename,'.');
+	if((extension!=NULL)&&(strchr(extension,'/')==NULL))
+		*extension='\0';
+	if(batch)
+	{
+		strcat(basename,"_");
+		strcat(basename,*(argv+2));
+	}
 	FILE*outputs[3];
-	strncpy(basename,*(argv+2),88);	
 	init_output(outputs,basename,num_plogs);
 
-	//for each individual, read in paralog-specific MIP read counts, calculate and store individual likelihoods of data for each MIP
-	//under each possible copy number state, and use dynamic programming to infer paralog-specific copy number genotypes
-	FILE*mipcounts=fopen(*(argv+2),"r");
-	char indiv[101];
-	double max0,nextmax0,max1,max2;
-	long imax0,imax1,imax2,indiv_states[3],tmips[2];
-	int num_trans;
-	while(getc(mipcounts)!='\n')
-		continue;
-	while(fscanf(mipcounts,"%s",indiv)==1) //while there remains data to process
+	//read in paralog-specific MIP read counts for all individuals
+	if(!batch)
 	{
-		fseek(mipcounts,(-1*strlen(indiv)),SEEK_CUR);
-		
-		//initialize likelihood graph counts and log-likelihoods for a new individual
-		init_graph(likelihood_graph,num_mip_targets,num_cstates);
-		
-		//process MIP data: get all relevant counts and calculate log-likelihoods of observed counts at each MIP under each possible copy number state
-		fill_graph(likelihood_graph,mipcounts,num_plogs,num_mip_targets,num_cstates,num_plogs+1,specs,copy_states);
-
-		//use dynamic programming to compute log-likelihoods for each copy number state and for best 1-transition and 2-transition paths ending at each copy number state
-		parse_graph(likelihood_graph,num_plogs,num_mip_targets,num_cstates,priors,copy_states);
-
-		//determine maximally likely paths having 0, 1, and 2 copy number state transitions and their corresponding log-likelihoods
-		get_path_maxes(likelihood_graph,num_mip_targets,num_cstates,&max0,&nextmax0,&max1,&max2,&imax0,&imax1,&imax2);	
-
-		//evaulate the evidence for multiple copy number states
-		num_trans=imax(assess_path(likelihood_graph,max0,max1,max2,imax1,imax2,num_mip_targets,num_cstates,indiv_states,tmips,2),assess_path(likelihood_graph,max0,max1,max2,imax1,imax2,num_mip_targets,num_cstates,indiv_states,tmips,1));
-
-		//print genotype information for the individual just analyzed
-		print_output(outputs,indiv,max0,nextmax0,max1,max2,imax0,num_trans,indiv_states,tmips,num_mip_targets,coords,num_cstates,num_plogs,copy_states);
+		mipcounts=fopen(*(argv+2),"r");
+		num_indivs=get_indivs(mipcounts,num_plogs,num_mip_targets,coords,&indivs);
 	}
 
+	//for each individual, calculate and store individual likelihoods of data for each MIP under each possible copy number state, and use
+	//dynamic programming to infer paralog-specific copy number genotypes (individuals are handed out to worker threads one at a time)
+	int nthreads=(argc>4)?strtol(*(argv+4),NULL,10):sysconf(_SC_NPROCESSORS_ONLN);
+	if(nthreads<1)
+		nthreads=1;
+	if(nthreads>num_indivs)
+		nthreads=(num_indivs>0)?num_indivs:1;
+	struct cnjob job={indivs,num_indivs,0,PTHREAD_MUTEX_INITIALIZER,num_plogs,num_mip_targets,num_cstates,&(specs[0][0]),spec_ids,log_probs,priors,&transitions};
+	pthread_t*workers=(pthread_t*)malloc(nthreads*sizeof(pthread_t));
+	long t;
+	for(t=0;t<nthreads;t++)
+		pthread_create(&(workers[t]),NULL,genotype,&job);
+	for(t=0;t<nthreads;t++)
+		pthread_join(workers[t],NULL);
+
+	//print genotype information for each individual in the order individuals appear in the mipcounts file
+	for(i=0;i<num_indivs;i++)
+		print_output(outputs,indivs[i].name,indivs[i].max0,indivs[i].nextmax0,indivs[i].max1,indivs[i].max2,indivs[i].imax0,indivs[i].num_trans,indivs[i].states,indivs[i].tmips,indivs[i].coords,num_cstates,num_plogs,copy_states);
+
 	//clean up and exit
-	free(likelihood_graph);
-	fclose(miptargets);
+	for(i=0;i<num_indivs;i++)
+	{
+		free(indivs[i].counts);
+		if(batch)
+			free(indivs[i].coords);
+	}
+	free(indivs);
+	free(workers);
+	free(transitions.start);
+	free(transitions.preds);
+	free(spec_ids);
+	free(log_probs);
+	free(coords);
+	free(specs);
+	free(priors);
+	free(copy_states);
+	free(copy_nums);
+	if(!batch)
+		fclose(miptargets);
 	fclose(mipcounts);
 	fclose(outputs[0]);
 	fclose(outputs[1]);
@@ -148,10 +280,21 @@ void get_mip_info(FILE*miptargs,long nummips,long speclength,long targlocs[nummi
 	return;
 }
 
-void set_priors(long numseqs,long parastates,long numstates,double priorvec[numstates],long cstates[numstates][numseqs])
+void*alloc_table(long n,size_t size)
+{
+	void*table;
+	if(posix_memalign(&table,ALIGN,((n>0)?n:1)*size))
+	{
+		printf(KRED "Unable to allocate memory for a table of %ld entries.\n",n);
+		exit(1);
+	}
+	return table;
+}
+
+void set_priors(long numseqs,long parastates,long numstates,double priorvec[numstates],unsigned char cstates[numstates][numseqs],long copynums[numstates])
 {
 	long i,s,num;
-	double pprobs[parastates];
+	double*pprobs=(double*)alloc_table(parastates,sizeof(double));
 	for(i=0;i<parastates;i++)
 	{
 		pprobs[i]=exp(L_PRIOR*labs(1-i)); //vector of prior probabilities for one haplotype having each copy number state (assume CN = 1 is most likely)
@@ -160,25 +303,69 @@ void set_priors(long numseqs,long parastates,long numstates,double priorvec[nums
 	{
 		num=i;
 		priorvec[i]=0;
+		copynums[i]=0;
 		for(s=(numseqs-1);s>=0;s--)
 		{
 			cstates[i][s]=num%parastates;
+			copynums[i]+=num%parastates;
 			priorvec[i]+=log(pprobs[num%parastates]);
 			num/=parastates;
 		}
 	}
+	free(pprobs);
 	return;
 }
 
+void build_transitions(long numseqs,long parastates,long numstates,unsigned char cnstates[numstates][numseqs],long copynums[numstates],struct translist*trans)
+{
+	long state,k,l,v,u,wk,wl,next,n=0;
+	long maxper=numseqs*(parastates-1)+numseqs*(numseqs-1)/2*(parastates-1)*(parastates-1); //candidate states differ in the copy number of one or two paralogs
+	trans->start=(long*)malloc((numstates+1)*sizeof(long));
+	trans->preds=(long*)malloc((numstates*maxper+1)*sizeof(long));
+	for(state=0;state<numstates;state++)
+	{
+		trans->start[state]=n;
+		for(k=0,wk=numstates/parastates;k<numseqs;k++,wk/=parastates) //states are numbered with the last paralog's copy number as the least significant digit
+		{
+			for(v=0;v<parastates;v++)
+			{
+				if(v==cnstates[state][k])
+					continue;
+				next=state+(v-cnstates[state][k])*wk;
+				trans->preds[n++]=next; //deletion or duplication of a single paralog
+				for(l=k+1,wl=wk/parastates;l<numseqs;l++,wl/=parastates)
+				{
+					for(u=0;u<parastates;u++)
+					{
+						next=state+(v-cnstates[state][k])*wk+(u-cnstates[state][l])*wl;
+						if((u!=cnstates[state][l])&&(copynums[next]==copynums[state])) //interlocus gene conversion changes two paralogs' copy numbers but not the total
+							trans->preds[n++]=next;
+					}
+				}
+			}
+		}
+		qsort(&(trans->preds[trans->start[state]]),n-trans->start[state],sizeof(long),compare_states); //visit predecessors in the same order as a scan over all states
+	}
+	trans->start[numstates]=n;
+	return;
+}
+
+int compare_states(const void*p1,const void*p2)
+{
+	const long*state1=p1;
+	const long*state2=p2;
+	return (*state1>*state2)-(*state1<*state2);
+}
+
 void init_output(FILE*outfiles[3],char*base,long numseqs)
 {
 	char*extensions[3]={".cncalls",".compevents",".simplecalls"};
+	char outname[strlen(base)+13];
 	long i;
 	for(i=0;i<3;i++)
 	{
-		base[strrchr(base,'.')-base]='\0';
-		strcat(base,extensions[i]);
-		outfiles[i]=fopen(base,"w");
+		sprintf(outname,"%s%s",base,extensions[i]);
+		outfiles[i]=fopen(outname,"w");
 	}
 	fprintf(outfiles[2],"Individual\t");
 	for(i=0;i<numseqs;i++)
@@ -189,6 +376,155 @@ void init_output(FILE*outfiles[3],char*base,long numseqs)
 	return;
 }
 
+long get_indivs(FILE*mcounts,long numseqs,long nummips,long*targlocs,struct indiv**indivs)
+{
+	long numindivs=0,maxindivs=64,mip,seq;
+	char name[NLEN];
+	*indivs=(struct indiv*)malloc(maxindivs*sizeof(struct indiv));
+	while(getc(mcounts)!='\n')
+		continue;
+	while(fscanf(mcounts,"%100s",name)==1) //each individual has one line per MIP target, and the first line gives the individual's name
+	{
+		if(numindivs==maxindivs)
+		{
+			maxindivs*=2;
+			*indivs=(struct indiv*)realloc(*indivs,maxindivs*sizeof(struct indiv));
+		}
+		strcpy((*indivs)[numindivs].name,name);
+		(*indivs)[numindivs].counts=(unsigned int*)calloc(nummips*numseqs,sizeof(unsigned int));
+		(*indivs)[numindivs].nummips=nummips;
+		(*indivs)[numindivs].maxmips=nummips;
+		(*indivs)[numindivs].coords=targlocs; //all individuals share the targets listed in the miptargets file
+		for(mip=0;mip<nummips;mip++)
+		{
+			if(mip)
+				fscanf(mcounts,"%*s");
+			fscanf(mcounts,"%*s %*s %*s");
+			for(seq=0;seq<numseqs;seq++)
+				fscanf(mcounts,"%u",&((*indivs)[numindivs].counts[mip*numseqs+seq]));
+		}
+		numindivs++;
+	}
+	return numindivs;
+}
+
+long count_columns(FILE*mcounts)
+{
+	long numcols=1;
+	int c;
+	while((c=getc(mcounts))!='\n')
+	{
+		if(c=='\t')
+			numcols++;
+	}
+	return numcols;
+}
+
+void set_specs(long nummips,long speclength,char specvecs[nummips][speclength])
+{
+	long mip,seq;
+	for(mip=0;mip<nummips;mip++)
+	{
+		for(seq=0;seq<(speclength-1);seq++)
+			specvecs[mip][seq]='A'+seq;
+		specvecs[mip][speclength-1]='\0';
+	}
+	return;
+}
+
+long get_contig_indivs(FILE*mcounts,char*contig,long numseqs,struct indiv**indivs)
+{
+	long numindivs=0,maxindivs=64,coord,seq;
+	char name[NLEN],ctg[NLEN];
+	unsigned int*counts=(unsigned int*)alloc_table(numseqs,sizeof(unsigned int));
+	struct indiv*ind;
+	*indivs=(struct indiv*)malloc(maxindivs*sizeof(struct indiv));
+	while(fscanf(mcounts,"%100s %100s %ld %*s",name,ctg,&coord)==3)
+	{
+		for(seq=0;seq<numseqs;seq++)
+			fscanf(mcounts,"%u",&(counts[seq]));
+		if(strcmp(ctg,contig))
+			continue;
+
+		//start a new individual whenever the sample name changes
+		if((!numindivs)||(strcmp(name,(*indivs)[numindivs-1].name)))
+		{
+			if(numindivs==maxindivs)
+			{
+				maxindivs*=2;
+				*indivs=(struct indiv*)realloc(*indivs,maxindivs*sizeof(struct indiv));
+			}
+			ind=&((*indivs)[numindivs]);
+			strcpy(ind->name,name);
+			ind->nummips=0;
+			ind->maxmips=16;
+			ind->counts=(unsigned int*)malloc(ind->maxmips*numseqs*sizeof(unsigned int));
+			ind->coords=(long*)malloc(ind->maxmips*sizeof(long));
+			numindivs++;
+		}
+
+		//add the MIP target to the current individual's targets
+		ind=&((*indivs)[numindivs-1]);
+		if(ind->nummips==ind->maxmips)
+		{
+			ind->maxmips*=2;
+			ind->counts=(unsigned int*)realloc(ind->counts,ind->maxmips*numseqs*sizeof(unsigned int));
+			ind->coords=(long*)realloc(ind->coords,ind->maxmips*sizeof(long));
+		}
+		for(seq=0;seq<numseqs;seq++)
+			ind->counts[ind->nummips*numseqs+seq]=counts[seq];
+		ind->coords[ind->nummips]=coord;
+		ind->nummips++;
+	}
+	free(counts);
+	return numindivs;
+}
+
+void*genotype(void*arg)
+{
+	struct cnjob*job=(struct cnjob*)arg;
+	long nseqs=job->numseqs,nmips,nstates=job->numstates,i,imax1,imax2;
+	char(*specvecs)[nseqs+1]=(char(*)[nseqs+1])job->specvecs;
+	struct indiv*ind;
+
+	//allocate storage for this thread's likelihood graph and for the counts and log-likelihoods at each MIP
+	struct node*likelihood_graph;
+	likelihood_graph=(struct node*)alloc_table(job->nummips*nstates,sizeof(struct node));
+	unsigned int*rawcounts=(unsigned int*)alloc_table(nseqs,sizeof(unsigned int));
+	unsigned int*counts=(unsigned int*)alloc_table(nseqs,sizeof(unsigned int));
+	double*likelihoods=(double*)alloc_table(nstates,sizeof(double));
+	while(1)
+	{
+		pthread_mutex_lock(&(job->lock));
+		i=job->next++;
+		pthread_mutex_unlock(&(job->lock));
+		if(i>=job->nindivs)
+			break;
+		ind=&(job->indivs[i]);
+		nmips=ind->nummips;
+
+		//initialize likelihood graph counts and log-likelihoods for a new individual
+		init_graph(likelihood_graph,nmips,nstates);
+
+		//process MIP data: consolidate counts and calculate log-likelihoods of observed counts at each MIP under each possible copy number state
+		fill_graph(likelihood_graph,ind->counts,nseqs,nmips,nstates,nseqs+1,specvecs,job->specids,job->logprobs,rawcounts,counts,likelihoods);
+
+		//use dynamic programming to compute log-likelihoods for each copy number state and for best 1-transition and 2-transition paths ending at each copy number state
+		parse_graph(likelihood_graph,nmips,nstates,job->priorvec,job->trans);
+
+		//determine maximally likely paths having 0, 1, and 2 copy number state transitions and their corresponding log-likelihoods
+		get_path_maxes(likelihood_graph,nmips,nstates,&(ind->max0),&(ind->nextmax0),&(ind->max1),&(ind->max2),&(ind->imax0),&imax1,&imax2);
+
+		//evaulate the evidence for multiple copy number states
+		ind->num_trans=imax(assess_path(likelihood_graph,ind->max0,ind->max1,ind->max2,imax1,imax2,nmips,nstates,ind->states,ind->tmips,2),assess_path(likelihood_graph,ind->max0,ind->max1,ind->max2,imax1,imax2,nmips,nstates,ind->states,ind->tmips,1));
+	}
+	free(likelihood_graph);
+	free(rawcounts);
+	free(counts);
+	free(likelihoods);
+	return NULL;
+}
+
 void init_graph(struct node*graph,long nummips,long numstates)
 {
 	long i;
@@ -204,34 +540,82 @@ void init_graph(struct node*graph,long nummips,long numstates)
 	return;
 }
 
-void fill_graph(struct node*graph,FILE*mcounts,long numseqs,long nummips,long numstates,long speclength,char specvecs[nummips][speclength],long cnstates[numstates][numseqs])
+double*build_logprobs(long numseqs,long nummips,long numstates,long speclength,char specvecs[nummips][speclength],unsigned char cnstates[numstates][numseqs],long copynums[numstates],long*specids)
+{
+	long mip,prev,nspecs=0,spec,cstate,seq;
+	double norm;
+	double*probs=(double*)alloc_table(numseqs,sizeof(double));
+	double*logprobs;
+
+	//assign each MIP the index of the first MIP with the same specificity
+	for(mip=0;mip<nummips;mip++)
+	{
+		for(prev=0;(prev<mip)&&(strcmp(specvecs[prev],specvecs[mip]));prev++)
+			continue;
+		specids[mip]=(prev<mip)?specids[prev]:nspecs++;
+	}
+
+	//for each distinct specificity, store the log-probability of each distinguishable sequence under each copy number state (states vary fastest)
+	logprobs=(double*)alloc_table(nspecs*numseqs*numstates,sizeof(double));
+	for(mip=0,spec=0;spec<nspecs;mip++)
+	{
+		if(specids[mip]!=spec)
+			continue;
+		for(cstate=0;cstate<numstates;cstate++)
+		{
+			init_probs(numseqs,probs);
+			for(seq=0;seq<numseqs;seq++)
+			{
+				probs[specvecs[mip][seq]-'A']+=(double)cnstates[cstate][seq]/(double)copynums[cstate];
+			}
+			norm=0.0;
+			for(seq=0;seq<numseqs;seq++)
+				norm+=probs[seq];
+			for(seq=0;seq<numseqs;seq++)
+				logprobs[(spec*numseqs+seq)*numstates+cstate]=log(probs[seq]/norm);
+		}
+		spec++;
+	}
+	free(probs);
+	return logprobs;
+}
+
+void fill_graph(struct node*graph,unsigned int*mcounts,long numseqs,long nummips,long numstates,long speclength,char specvecs[nummips][speclength],long*specids,double*logprobs,unsigned int*rawcounts,unsigned int*counts,double*likelihoods)
 {
-	long mip,cstate,seq,copynum;
-	unsigned int rawcounts[numseqs],counts[numseqs];
-	double probs[numseqs];
+	long mip,cstate,seq;
+	unsigned int total;
+	double lnfact,n,*lprobs;
 	for(mip=0;mip<nummips;mip++)
 	{
 		//initialize counts
 		init_counts(numseqs,rawcounts,counts);
 		
-		//read in raw counts and convert to final counts based on the specificity of the MIP
-		fscanf(mcounts,"%*s %*s %*s %*s");
+		//get raw counts and convert to final counts based on the specificity of the MIP
+		total=0;
 		for(seq=0;seq<numseqs;seq++)
 		{
-			fscanf(mcounts,"%u",&(rawcounts[seq]));
+			rawcounts[seq]=mcounts[mip*numseqs+seq];
 			counts[specvecs[mip][seq]-'A']+=rawcounts[seq]; //consolidate counts from identical sequences
+			total+=rawcounts[seq];
 		}
 		
-		//calculate likelihoods of observed counts at each MIP under each possible copy number state
+		//calculate multinomial log-likelihoods of observed counts at each MIP under each possible copy number state; the log-factorial terms
+		//depend only on the counts, so they are computed once per MIP, and cached log-probabilities are used for each copy number state
 		for(cstate=0;cstate<numstates;cstate++)
+			likelihoods[cstate]=LNFACT(total);
+		for(seq=0;seq<numseqs;seq++)
 		{
-			init_probs(numseqs,probs);
-			copynum=num_copies(cstate,numseqs,numstates,cnstates);
-			for(seq=0;seq<numseqs;seq++)
-			{
-				probs[specvecs[mip][seq]-'A']+=(double)cnstates[cstate][seq]/(double)copynum;
-			}
-			graph[mip*numstates+cstate].likelihood=gsl_ran_multinomial_lnpdf(numseqs,probs,counts);
+			if(!(counts[seq])) //sequences with no reads do not contribute to the likelihood (even if they cannot be observed under some copy number states)
+				continue;
+			lnfact=LNFACT(counts[seq]);
+			n=(double)counts[seq];
+			lprobs=&(logprobs[(specids[mip]*numseqs+seq)*numstates]);
+			for(cstate=0;cstate<numstates;cstate++)
+				likelihoods[cstate]+=lprobs[cstate]*n-lnfact;
+		}
+		for(cstate=0;cstate<numstates;cstate++)
+		{
+			graph[mip*numstates+cstate].likelihood=likelihoods[cstate];
 			if(graph[mip*numstates+cstate].likelihood<L_MIN)
 			{
 				graph[mip*numstates+cstate].likelihood=L_MIN;
@@ -252,16 +636,6 @@ void init_counts(long nseqs,unsigned int rcounts[nseqs],unsigned int fcounts[nse
 	return;
 }
 
-long num_copies(long state,long nseqs,long nstates,long copystates[nstates][nseqs])
-{
-	long copynum=0,s;
-	for(s=0;s<nseqs;s++)
-	{
-		copynum+=copystates[state][s];
-	}
-	return copynum;
-}
-
 void init_probs(long nseqs,double pvec[nseqs])
 {
   long i;
@@ -272,9 +646,10 @@ void init_probs(long nseqs,double pvec[nseqs])
   return;
 }
 
-void parse_graph(struct node*graph,long numseqs,long nummips,long numstates,double priorvec[numstates],long cnstates[numstates][numseqs])
+void parse_graph(struct node*graph,long nummips,long numstates,double priorvec[numstates],struct translist*trans)
 {
-	long i;
+	long i,j;
+	double lmax0=-DBL_MAX,lmax1=-DBL_MAX;
 	for(i=0;i<(nummips*numstates);i++)
 	{
 		if(!(i/numstates))
@@ -285,9 +660,19 @@ void parse_graph(struct node*graph,long numseqs,long nummips,long numstates,doub
 		}
 		else
 		{
+			if(!(i%numstates)) //at the start of each MIP, find the best 0-transition and 1-transition log-likelihoods over all states at the previous MIP
+			{
+				lmax0=-DBL_MAX;
+				lmax1=-DBL_MAX;
+				for(j=(i-numstates);j<i;j++)
+				{
+					lmax0=dmax(lmax0,graph[j].max_0t);
+					lmax1=dmax(lmax1,graph[j].max_1t);
+				}
+			}
 			graph[i].max_0t=graph[i].likelihood+graph[i-numstates].max_0t;
-			graph[i].max_1t=graph[i].likelihood+segmax(graph,i,numseqs,numstates,cnstates,1);
-			graph[i].max_2t=graph[i].likelihood+segmax(graph,i,numseqs,numstates,cnstates,2);
+			graph[i].max_1t=graph[i].likelihood+segmax(graph,i,numstates,trans,lmax0,1);
+			graph[i].max_2t=graph[i].likelihood+segmax(graph,i,numstates,trans,lmax1,2);
 			if((i/numstates)==(nummips-1)) //for genotypes with at least one copy number state transition, apply priors to end as well
     	{
       	graph[i].max_1t+=priorvec[i%numstates];
@@ -298,41 +683,30 @@ void parse_graph(struct node*graph,long numseqs,long nummips,long numstates,doub
 	return;
 }
 
-double segmax(struct node*lgraph,long index,long nseqs,long nstates,long copystates[nstates][nseqs],int path)
+double segmax(struct node*lgraph,long index,long nstates,struct translist*trans,double layermax,int path)
 {
 	double max,tmax;
 	struct node*prev;
-	long j;
+	long j,p,state=index%nstates;
 	max=((path==1)?lgraph[index-nstates].max_1t:lgraph[index-nstates].max_2t);
 	prev=&(lgraph[index-nstates]);
-	for(j=(index-nstates-index%nstates);j<(index-index%nstates);j++)
+	if(layermax>max) //otherwise no state at the previous MIP can improve on remaining in the same copy number state
 	{
-		tmax=((path==1)?lgraph[j].max_0t:lgraph[j].max_1t);
-		if((tmax>max)&&(trans_good(index,j,nstates,nseqs,copystates)))
+		for(p=trans->start[state];p<trans->start[state+1];p++)
 		{
-			max=tmax;
-			prev=&(lgraph[j]);
+			j=index-nstates-state+trans->preds[p];
+			tmax=((path==1)?lgraph[j].max_0t:lgraph[j].max_1t);
+			if(tmax>max)
+			{
+				max=tmax;
+				prev=&(lgraph[j]);
+			}
 		}
 	}
 	if(path==1) lgraph[index].path_1t=prev; else lgraph[index].path_2t=prev;
 	return max;
 }
 
-int trans_good(long index,long index2,long n_states,long n_seqs,long pscn_states[n_states][n_seqs])
-{
-	long changes=0,copies=0,copies2=0,k;
-	for(k=0;k<n_seqs;k++)
-	{
-		if(pscn_states[index%n_states][k]!=pscn_states[index2%n_states][k])
-		{
-			changes++;
-		}
-		copies+=pscn_states[index%n_states][k];
-		copies2+=pscn_states[index2%n_states][k];
-	}
-	return ((changes==1)||((changes==2)&&(copies==copies2))); //transition is valid if paralog-specific copy number genotype change is due to deletion or duplication of a single paralog or interlocus gene conversion
-}
-
 void get_path_maxes(struct node*lgraph,long nmips,long nstates,double*m0,double*nm0,double*m1,double*m2,long*im0,long*im1,long*im2)
 {
 	long i;
@@ -438,7 +812,7 @@ double dmax(double d1,double d2)
   return (d1>d2)?d1:d2;
 }
 
-void print_output(FILE*outfiles[3],char*individual,double m0,double nm0,double m1,double m2,long im0,int ntrans,long*cnstates,long*edgemips,long nummips,long targlocs[nummips],long nstates,long nseqs,long copystates[nstates][nseqs])
+void print_output(FILE*outfiles[3],char*individual,double m0,double nm0,double m1,double m2,long im0,int ntrans,long*cnstates,long*edgemips,long*targlocs,long nstates,long nseqs,unsigned char copystates[nstates][nseqs])
 {
 	double lodscore=dmin((m0-nm0),LOD_MAX);
 	long k;
@@ -454,7 +828,7 @@ void print_output(FILE*outfiles[3],char*individual,double m0,double nm0,double m
 		fprintf(outfiles[2],"%s\t",individual);
 		for(k=0;k<nseqs;k++)
     {
-      fprintf(outfiles[2],"%ld\t",copystates[im0%nstates][k]);
+      fprintf(outfiles[2],"%d\t",copystates[im0%nstates][k]);
     }	
     fprintf(outfiles[2],"%lf\tYES\n",lodscore);
 		if(ntrans==1)
@@ -494,7 +868,7 @@ void print_output(FILE*outfiles[3],char*individual,double m0,double nm0,double m
 		fprintf(outfiles[2],"%s\t",individual);
 		for(k=0;k<nseqs;k++)
 		{
-			fprintf(outfiles[2],"%ld\t",copystates[im0%nstates][k]);
+			fprintf(outfiles[2],"%d\t",copystates[im0%nstates][k]);
 		}
 		fprintf(outfiles[2],"%lf\tNO\n",lodscore);
 	}
@@ -506,12 +880,20 @@ double dmin(double d1,double d2)
   return (d1<d2)?d1:d2;
 }
 
-void print_pscn(FILE*out,long state,long n_states,long n_seqs,long pscn_states[n_states][n_seqs])
+void print_pscn(FILE*out,long state,long n_states,long n_seqs,unsigned char pscn_states[n_states][n_seqs])
 {
 	long s;
 	for(s=0;s<n_seqs;s++)
   {
-    fprintf(out,"%ld",pscn_states[state][s]);
+    fprintf(out,"%d",pscn_states[state][s]);
   }
 	return;	
 }
+
+#ifdef NO_GSL
+double ln_fact(unsigned int n)
+{
+	int sign; //lgamma_r returns the sign of the gamma function here rather than in the global signgam, so worker threads can call it concurrently
+	return lgamma_r((double)n+1.0,&sign);
+}
+#endif
@@ -15,6 +15,7 @@
 #include<string.h>
 #include<stdlib.h>
 #include<ctype.h>
+#include<stddef.h>
 #include<zlib.h>
 #define NLEN 200 //size of character vectors for storing names, etc.
 #define LLEN 1500 //maximum length of single line of text in input finalseqs file
@@ -26,6 +27,16 @@ struct miptarg
 	int captured;
 };
 
+//set up structure to store a hash table of names for fast lookup; the table holds indices into an array of records, each of which stores
+//its name at the same offset from the start of the record
+struct nameindex
+{
+	long*ids;
+	long size;
+	char*names; //name of the first record
+	long stride; //size of each record
+};
+
 //set up structure to store PB integration genotypes and MIP presence/absence patterns
 struct genotype
 {
@@ -37,7 +48,9 @@ long count_targs(FILE*mtargs);
 void get_targ_info(FILE*mtargs,struct miptarg*targs);
 long count_genotypes(FILE*gcodes);
 void get_geno_info(FILE*gcodes,struct genotype*gtypes);
-long findmip(char*mipname,struct miptarg*targs,long numtargs);
+void build_nameindex(struct nameindex*index,char*names,long stride,long numnames);
+unsigned long hash_name(char*name);
+long findname(char*name,struct nameindex*index);
 long findgeno(char*code,struct genotype*gtypes,long numstats);
 
 int main(int argc,char*argv[])
@@ -53,8 +66,10 @@ int main(int argc,char*argv[])
 	struct miptarg*targets;
 	targets=(struct miptarg*)malloc(ntargs*sizeof(struct miptarg));
 
-	//read in information on MIP targets
+	//read in information on MIP targets and index MIP names for fast lookup
 	get_targ_info(miptargs,targets);
+	struct nameindex mipindex;
+	build_nameindex(&mipindex,(char*)targets+offsetof(struct miptarg,name),sizeof(struct miptarg),ntargs);
 
 	//determine the number of PB integration genotypes and allocate memory to store genotype information
 	FILE*pbcode=fopen(*(argv+3),"r");
@@ -72,7 +87,7 @@ int main(int argc,char*argv[])
 	while(gzgets(finalseqs,line,LLEN))
 	{
 		sscanf(line,"%*s %s %*s %*s %*s %*s %*s %*s %*s %*s",mip);
-		m=findmip(mip,targets,ntargs);
+		m=findname(mip,&mipindex);
 		if(m>=0)
 			targets[m].captured=1;
 	}
@@ -98,6 +113,7 @@ int main(int argc,char*argv[])
 
 	//clean up and exit
 	free(targets);
+	free(mipindex.ids);
 	free(genotypes);
 	gzclose(finalseqs);
 	fclose(miptargs);
@@ -149,13 +165,49 @@ void get_geno_info(FILE*gcodes,struct genotype*gtypes)
 	return;
 }
 
-long findmip(char*mipname,struct miptarg*targs,long numtargs)
+void build_nameindex(struct nameindex*index,char*names,long stride,long numnames)
+{
+	long n,slot;
+	index->size=1;
+	while(index->size<2*numnames) //keep the table at most half full so probe sequences stay short
+		index->size*=2;
+	index->ids=(long*)malloc(index->size*sizeof(long));
+	index->names=names;
+	index->stride=stride;
+	for(slot=0;slot<index->size;slot++)
+		index->ids[slot]=-1;
+	for(n=0;n<numnames;n++)
+	{
+		if(findname(names+n*stride,index)!=-1) //if a name is listed more than once, lookups return the first record with that name
+			continue;
+		slot=hash_name(names+n*stride)&(index->size-1);
+		while(index->ids[slot]!=-1)
+			slot=(slot+1)&(index->size-1);
+		index->ids[slot]=n;
+	}
+	return;
+}
+
+unsigned long hash_name(char*name)
+{
+	unsigned long h=14695981039346656037UL; //FNV-1a hash
+	long i;
+	for(i=0;(i<NLEN)&&(name[i]!='\0');i++)
+	{
+		h^=(unsigned char)name[i];
+		h*=1099511628211UL;
+	}
+	return h;
+}
+
+long findname(char*name,struct nameindex*index)
 {
-	long mipp;
-	for(mipp=0;mipp<numtargs;mipp++)
+	long slot=hash_name(name)&(index->size-1);
+	while(index->ids[slot]!=-1)
 	{
-		if(strncmp(mipname,targs[mipp].name,NLEN)==0)
-			return mipp;
+		if(strncmp(index->names+index->ids[slot]*index->stride,name,NLEN)==0)
+			return index->ids[slot];
+		slot=(slot+1)&(index->size-1);
 	}
 	return -1;
 }
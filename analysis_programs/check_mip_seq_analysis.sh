@@ -0,0 +1,36 @@
+#!/usr/bin/env bash
+
+#Xander Nuttle
+#check_mip_seq_analysis.sh
+#Call: bash /data/talkowski/xander/MIPs/analysis_programs/check_mip_seq_analysis.sh mip_seq_analysis_program regression_directory miptargets_file genome_fasta_file
+#
+#Runs a build of mip_seq_analysis on the merged reads of each regression set (a file *.fastq in the regression directory, e.g.,
+#other_files/regression) and checks that the mipseqs output is identical to the expected output (the corresponding *.mipseqs file).
+#Exits with status 1 if the output differs for any set. The regression sets in other_files/regression are assigned against
+#other_files/genomes/PB_indels_tagged/miptargets/ADNP_indel_guide_1.miptargets and contigs/ADNP_indel_guide_1.fasta.
+#
+#compensating_indels.fastq holds reads of one MIP carrying an indel and a nearby compensating indel, which must be reported as indels
+#(as bwa reports them) rather than as runs of mismatches.
+
+PROG=$(readlink -f $1)
+REG_DIR=$(readlink -f $2)
+MTARGS=$(readlink -f $3)
+GENOME=$(readlink -f $4)
+WORK_DIR=$(mktemp -d)
+
+nfail=0
+for file in $REG_DIR/*.fastq; do
+	SET_NAME=$(basename $file .fastq)
+	gzip -c $file > $WORK_DIR/${SET_NAME}.fastq.gz
+	(cd $WORK_DIR && $PROG ${SET_NAME}.fastq.gz $MTARGS $GENOME)
+	if cmp -s <(zcat $WORK_DIR/${SET_NAME}.mipseqs.gz) $REG_DIR/${SET_NAME}.mipseqs; then
+		echo -e "${SET_NAME}\tidentical"
+	else
+		echo -e "${SET_NAME}\tDIFFERENT"
+		nfail=$((nfail+1))
+	fi
+done
+rm -r $WORK_DIR
+if [ $nfail -gt 0 ]; then
+	exit 1
+fi
@@ -1,20 +1,36 @@
 //Xander Nuttle
 //count_mipseqs.c
-//Call: ./count_mipseqs text_file_with_names_of_gzipped_mipseqs_files(sample.seqsfiles) miptargets_file
+//Call: ./count_mipseqs text_file_with_names_of_gzipped_mipseqs_files(sample.seqsfiles) miptargets_file <(long)depth_cutoff (double)allele_fraction_cutoff> <seqcounts> <paralog1_miptargets_file paralog2_miptargets_file>
 //
 //This program analyses a set of gzipped mipseqs files for a sample and outputs all distinct sequences at each MIP target
 //along with all corresponding information, including the number of different molecular tags associated with that sequence.
 //This information can then be used to determine which sequences should be deemed present at each MIP target site based off
 //tag count and allele fraction filtering with the program finalize_mipseqs.c
+//
+//If a depth cutoff and an allele fraction cutoff are given as the third and fourth command line arguments, this program instead does the
+//work of finalize_mipseqs and finalseqs_to_mipcounts itself, filtering the sequences at each MIP target while they are still in memory and
+//directly generating the gzipped finalseqs file (e.g., sample.dp10.af0.1.finalseqs.gz) and the mipcounts file (sample.mipcounts). These are
+//identical to the files generated by running count_mipseqs, finalize_mipseqs, and finalseqs_to_mipcounts in turn. In this case the
+//gzipped seqcounts file is only generated if "seqcounts" is given as a fifth command line argument.
+//
+//If the miptargets files for two paralogous contigs (e.g., chrHYDIN.miptargets and chrHYDIN2.miptargets) are also given (after "seqcounts", if
+//present), counts at MIPs on either paralog are instead combined into paralog-specific counts in the mipcounts file. Each MIP on the first paralog
+//is paired with the MIP on the second paralog whose name has the second paralog's contig name in place of the first's (e.g., chrHYDIN_MIP_0001 and
+//chrHYDIN2_MIP_0001). For each pair, the summed counts of the two most abundant sequences at each MIP are printed as the first and second count
+//columns of a single 'B' type line for the first paralog's contig and coordinate. These lines follow all other lines, in the order of MIPs in the
+//first paralog's miptargets file.
 
 #include<stdio.h>
 #include<stdlib.h>
 #include<string.h>
+#include<stddef.h>
 #include<zlib.h>
 #define NLEN 200 //maximum length of names (sample, contig, mipseqs file) and of mapping coordinate converted to a string
 #define SLEN 500 //maximum length of each sequence array (and corresponding quality array)
 #define TLEN 8 //length of molecular tag sequences
 #define LLEN 1500 //maximum length of single line of text in input mipseqs file
+#define MINSLOTS 8 //initial size of the hash tables of sequences at each MIP target and of molecular tags associated with each sequence
+#define ABLOCK 1048576 //size of each block of memory from which sequences, quality sums, and names are allocated
 
 //set up structure to store MIP target information, including all sequences assigned to the MIP and associated tag counts
 struct miptarg
@@ -22,29 +38,80 @@ struct miptarg
 	char mip[NLEN+1];
 	char miptype[NLEN+1];
 	char crispr[NLEN+1];
-	struct mipseq*seqs;
+	struct mipseq*seqs; //distinct sequences, in the order in which they were first observed
+	long nseqs;
+	long maxseqs;
+	long*slots; //hash table of indices into seqs, keyed on sequence
+	long size;
+};
+
+//set up structure to store a hash table of names for fast lookup; the table holds indices into an array of records, each of which stores
+//its name at the same offset from the start of the record
+struct nameindex
+{
+	long*ids;
+	long size;
+	char*names; //name of the first record
+	long stride; //size of each record
+};
+
+//set up structure to store the molecular tags associated with a sequence; each tag is encoded in 2 bits per base and stored in a hash
+//set, with a bitmap marking occupied slots (a tag containing a base other than A, C, G, or T is instead stored in a linked list)
+struct tagset
+{
+	unsigned short*codes;
+	unsigned char*used;
+	long size;
+	long ncodes;
+	struct moltag*other;
+};
+
+//set up structure to store a bump allocator; memory for sequences, quality sums, and names is handed out from large blocks which are
+//only released when the program finishes
+struct arena
+{
+	char**blocks;
+	long nblocks;
+	long used; //number of bytes used in the last block
+};
+
+//set up structure to store a hash table of interned strings (contig names and mapping coordinates), so each distinct string is stored once
+struct strtable
+{
+	char**strs;
+	long size;
+	long nstrs;
 };
 
 //set up structure to store data for each distinct sequence at a MIP target
 struct mipseq
 {
-	char contig[NLEN+1];
-	char maploc[NLEN+1];
-	char seq[SLEN+1];
-	double qual[SLEN+1];
+	char*contig; //interned
+	char*maploc; //interned
+	char*seq;
+	unsigned int*qual; //sum of quality values at each position of the sequence
+	long length;
 	long seqcount;
 	long tagcount;
-	struct moltag*tags;
-	struct mipseq*next;
+	unsigned long hash;
+	struct tagset tags;
 };
 
-//set up structure to store data for each molecular tag associated with a guide target sequence
+//set up structure to store data for each molecular tag which cannot be encoded in 2 bits per base
 struct moltag
 {
 	char tag[TLEN+1];
 	struct moltag*next;
 };
 
+//set up structure to store the tag count and allele fraction of a sequence when calling final sequences at a MIP target
+struct seqcall
+{
+	struct mipseq*seq;
+	long tagcount;
+	double tagfreq;
+};
+
 //set up structure to store data for each input sequence
 struct input
 {
@@ -58,25 +125,85 @@ struct input
 	char tag[TLEN+1];
 };
 
+//set up structure to store a MIP target read from a paralog's miptargets file
+struct paralogtarg
+{
+	char name[NLEN+1];
+	char contig[NLEN+1];
+	long coord; //target coordinate, as reported in the finalseqs file
+};
+
+//set up structure to store a pair of MIP targets at corresponding positions on two paralogs and the counts at each
+struct mippair
+{
+	long coord1;
+	long coord2;
+	long count1;
+	long count2;
+};
+
+//set up structure to store the position of a pair in the table of pairs, keyed on the target coordinate on one paralog
+struct coordindex
+{
+	long coord;
+	long pair;
+};
+
+//set up structure to store the pairing of two paralogs' MIP targets, indexed by the target coordinate on each paralog
+struct pairtable
+{
+	char contig1[NLEN+1];
+	char contig2[NLEN+1];
+	struct mippair*pairs; //in the order of MIP targets in the first paralog's miptargets file
+	long npairs;
+	struct coordindex*by1; //sorted by target coordinate on the first paralog
+	struct coordindex*by2; //sorted by target coordinate on the second paralog
+};
+
 long count_targs(FILE*mtargs);
 void init_targs(struct miptarg*targs,FILE*mtargs);
 int getinput(gzFile*mseqs,struct input*iseq);
-void process(struct input*iseq,struct miptarg*targs,long numtargs);
-long findtarg(char*myp,struct miptarg*targets,long ntargets);
-int isnew(struct input*seqin,struct miptarg*targets,long index);
-void addseq(struct input*seqin,struct miptarg*targets,long index);
-void init_seqs(struct input*seqi,struct miptarg*mtargets,long indx);
-void init_qual(double*curqual,char*newqual);
-void update(struct input*seqin,struct miptarg*targets,long index);
-void udqual(double*curqual,char*newqual);
-void udmapping(char*curchr,char*curcoord,char*newchr,char*newcoord);
-int newtag(char*intag,struct moltag*taglist);
-void udtags(char*intag,struct moltag*taglist);
-gzFile* init_output(gzFile*scounts,char*basename);
+void process(struct input*iseq,struct miptarg*targs,struct nameindex*mindex,struct arena*mem,struct strtable*strs);
+void build_nameindex(struct nameindex*index,char*names,long stride,long numnames);
+unsigned long hash_name(char*name);
+long findname(char*name,struct nameindex*index);
+unsigned long hash_seq(char*seq);
+long findseq(char*seq,unsigned long h,struct miptarg*target);
+long addseq(struct input*seqin,unsigned long h,struct miptarg*target,struct arena*mem,struct strtable*strs);
+void grow_seqs(struct miptarg*target);
+void init_qual(unsigned int*curqual,long length,char*newqual);
+void update(struct input*seqin,struct mipseq*current,struct arena*mem,struct strtable*strs);
+void udqual(unsigned int*curqual,long length,char*newqual);
+char*udmapping(char*cur,char*new,struct arena*mem,struct strtable*strs);
+void*arena_alloc(struct arena*mem,long nbytes);
+char*intern(char*str,struct arena*mem,struct strtable*strs);
+void grow_strtable(struct strtable*strs);
+int encode_tag(char*tag,unsigned short*code);
+long hash_tag(unsigned short code,long size);
+void init_tags(struct tagset*tset);
+int addtag(char*intag,struct tagset*tset);
+void grow_tags(struct tagset*tset);
+gzFile* init_output(char*basename);
 void print_data(gzFile*scounts,char*samp,struct miptarg*targs,long numtargs);
-char*avgqual(double*curqual,long count,char*curseq,char*newqual);
+char*avgqual(unsigned int*curqual,long count,long length,char*newqual);
+gzFile* init_finalseqs(char*basename,long dp,double af,char*afstr);
+FILE*init_mipcounts(char*basename);
+void call_seqs(gzFile*fseqs,FILE*mcounts,char*samp,struct miptarg*targs,long numtargs,long dp,double af,struct pairtable*ptab);
+int compfun(const void*p1,const void*p2);
+void filter_dp(struct seqcall*calls,long numseqs,long dp);
+long counttags(struct seqcall*calls,long numseqs);
+void filter_af(struct seqcall*calls,long numseqs,double af,long count);
+int informative(char*miptype,char*samp);
+struct pairtable*init_pairs(char*targsfile1,char*targsfile2);
+long get_paralog_targs(char*targsfile,struct paralogtarg**targs);
+int compare_names(const void*p1,const void*p2);
+int compare_coords(const void*p1,const void*p2);
+int add_pair_counts(struct pairtable*ptab,char*contig,char*maploc,long count);
+void print_pairs(FILE*out,char*samp,struct pairtable*ptab);
+void free_pairs(struct pairtable*ptab);
 void freeseqs(struct miptarg*targs,long numtargs);
-void freetags(struct moltag*taglist);
+void free_arena(struct arena*mem);
+void freetags(struct tagset*tset);
 
 int main(int argc,char*argv[])
 {
@@ -91,8 +218,15 @@ int main(int argc,char*argv[])
 	struct miptarg*mtargs;
 	mtargs=(struct miptarg*)malloc(ntargs*sizeof(struct miptarg));	
 
-	//read in MIP names and initialize MIP target data
+	//read in MIP names, initialize MIP target data, and index MIP names for fast lookup
 	init_targs(mtargs,miptargs);
+	struct nameindex mipindex;
+	build_nameindex(&mipindex,(char*)mtargs+offsetof(struct miptarg,mip),sizeof(struct miptarg),ntargs);
+
+	//set up storage for sequences, quality sums, and interned names
+	struct arena mem={NULL,0,ABLOCK};
+	struct strtable strs={NULL,0,0};
+	grow_strtable(&strs);
 
 	//read in names of gzipped mipseqs files to process and process gzipped mipseqs files one by one
 	FILE*filelist=fopen(*(argv+1),"r");
@@ -104,18 +238,50 @@ int main(int argc,char*argv[])
 		mipseqs=gzopen(seqfile,"r");
 		getinput(mipseqs,&inseq); //process header line		
 		while(getinput(mipseqs,&inseq))
-			process(&inseq,mtargs,ntargs);	
+			process(&inseq,mtargs,&mipindex,&mem,&strs);	
 		gzclose(mipseqs);
 	}
 
 	//set up output file and print data for each guide target
-	gzFile*seqcounts=init_output(seqcounts,sample);
-	print_data(seqcounts,sample,mtargs,ntargs);
+	gzFile*seqcounts;
+	int a=5,printseqs=(argc<5);
+	if((argc>a)&&(strcmp(*(argv+a),"seqcounts")==0))
+	{
+		printseqs=1;
+		a++;
+	}
+	if(printseqs)
+	{
+		seqcounts=init_output(sample);
+		print_data(seqcounts,sample,mtargs,ntargs);
+		gzclose(seqcounts);
+	}
+
+	//if depth and allele fraction cutoffs are given, call final sequences at each MIP target and generate finalseqs and mipcounts files
+	if(argc>4)
+	{
+		long mindp=strtol(*(argv+3),NULL,10);
+		double minaf=strtod(*(argv+4),NULL);
+		gzFile*finalseqs=init_finalseqs(sample,mindp,minaf,*(argv+4));
+		FILE*mipcounts=init_mipcounts(sample);
+
+		//if miptargets files for two paralogs are given, pair their MIP targets
+		struct pairtable*ptable=NULL;
+		if(argc>a+1)
+			ptable=init_pairs(*(argv+a),*(argv+a+1));
+		call_seqs(finalseqs,mipcounts,sample,mtargs,ntargs,mindp,minaf,ptable);
+		if(ptable!=NULL)
+			free_pairs(ptable);
+		gzclose(finalseqs);
+		fclose(mipcounts);
+	}
 
 	//clean up and exit
 	freeseqs(mtargs,ntargs);
 	free(mtargs);
-	gzclose(seqcounts);
+	free(mipindex.ids);
+	free(strs.strs);
+	free_arena(&mem);
 	fclose(filelist);
 	fclose(miptargs);
 	return 0;
@@ -142,6 +308,10 @@ void init_targs(struct miptarg*targs,FILE*mtargs)
 	while(fscanf(mtargs,"%s %*s %*s %*s %*s %s %s %*s %*s %*s",targs[m].mip,targs[m].miptype,targs[m].crispr)==3)
 	{
 		targs[m].seqs=NULL;
+		targs[m].nseqs=0;
+		targs[m].maxseqs=0;
+		targs[m].slots=NULL;
+		targs[m].size=0;
 		m++;
 	}
 	return;
@@ -158,163 +328,338 @@ int getinput(gzFile*mseqs,struct input*iseq)
 	return (scanned==8);
 }
 
-void process(struct input*iseq,struct miptarg*targs,long numtargs)
+void process(struct input*iseq,struct miptarg*targs,struct nameindex*mindex,struct arena*mem,struct strtable*strs)
 {
-	long m=findtarg(iseq->mip,targs,numtargs);
-	if(isnew(iseq,targs,m))
+	long m=findname(iseq->mip,mindex);
+	if(m==-1)
+		return;
+	unsigned long h=hash_seq(iseq->seq);
+	long s=findseq(iseq->seq,h,&(targs[m]));
+	if(s==-1)
 	{
-		addseq(iseq,targs,m);
+		addseq(iseq,h,&(targs[m]),mem,strs);
 	}
 	else
 	{
-		update(iseq,targs,m);
+		update(iseq,&(targs[m].seqs[s]),mem,strs);
 	}
 	return;
 }
 
-long findtarg(char*myp,struct miptarg*targets,long ntargets)
+void build_nameindex(struct nameindex*index,char*names,long stride,long numnames)
 {
-	long mnum;
-	for(mnum=0;mnum<ntargets;mnum++)
+	long n,slot;
+	index->size=1;
+	while(index->size<2*numnames) //keep the table at most half full so probe sequences stay short
+		index->size*=2;
+	index->ids=(long*)malloc(index->size*sizeof(long));
+	index->names=names;
+	index->stride=stride;
+	for(slot=0;slot<index->size;slot++)
+		index->ids[slot]=-1;
+	for(n=0;n<numnames;n++)
 	{
-		if(strncmp(targets[mnum].mip,myp,NLEN)==0)
-			break;
+		if(findname(names+n*stride,index)!=-1) //if a name is listed more than once, lookups return the first record with that name
+			continue;
+		slot=hash_name(names+n*stride)&(index->size-1);
+		while(index->ids[slot]!=-1)
+			slot=(slot+1)&(index->size-1);
+		index->ids[slot]=n;
 	}
-	if(mnum==ntargets)
-		mnum=-1;
-	return mnum;
+	return;
 }
 
-int isnew(struct input*seqin,struct miptarg*targets,long index)
+unsigned long hash_name(char*name)
 {
-	struct mipseq*current=targets[index].seqs;
-	while(current!=NULL)
+	unsigned long h=14695981039346656037UL; //FNV-1a hash
+	long i;
+	for(i=0;(i<NLEN)&&(name[i]!='\0');i++)
 	{
-		if(strncmp(current->seq,seqin->seq,SLEN)==0)
-			return 0;
-		current=current->next;
+		h^=(unsigned char)name[i];
+		h*=1099511628211UL;
 	}
-	return 1;
+	return h;
 }
 
-void addseq(struct input*seqin,struct miptarg*targets,long index)
+long findname(char*name,struct nameindex*index)
 {
-	struct mipseq*current=targets[index].seqs;
-	if(current==NULL)
-		init_seqs(seqin,targets,index);
-	else
+	long slot=hash_name(name)&(index->size-1);
+	while(index->ids[slot]!=-1)
 	{
-		while(current->next!=NULL)
-			current=current->next;
-		current->next=(struct mipseq*)malloc(sizeof(struct mipseq));
-		strncpy(current->next->contig,seqin->contig,NLEN);
-		strncpy(current->next->maploc,seqin->maploc,NLEN);
-		strncpy(current->next->seq,seqin->seq,SLEN);
-		init_qual(current->next->qual,seqin->qual);
-		current->next->seqcount=1;
-		current->next->tagcount=1;
-		current->next->tags=(struct moltag*)malloc(sizeof(struct moltag));
-		strncpy(current->next->tags->tag,seqin->tag,TLEN);
-		current->next->tags->next=NULL;
-		current->next->next=NULL;
+		if(strncmp(index->names+index->ids[slot]*index->stride,name,NLEN)==0)
+			return index->ids[slot];
+		slot=(slot+1)&(index->size-1);
 	}
-	return;
+	return -1;
+}
+
+unsigned long hash_seq(char*seq)
+{
+	unsigned long h=14695981039346656037UL; //FNV-1a hash
+	long i;
+	for(i=0;(i<SLEN)&&(seq[i]!='\0');i++)
+	{
+		h^=(unsigned char)seq[i];
+		h*=1099511628211UL;
+	}
+	return h;
 }
 
-void init_seqs(struct input*seqi,struct miptarg*mtargets,long indx)
+long findseq(char*seq,unsigned long h,struct miptarg*target)
 {
-	mtargets[indx].seqs=(struct mipseq*)malloc(sizeof(struct mipseq));
-	struct mipseq*cur=mtargets[indx].seqs;
-	strncpy(cur->contig,seqi->contig,NLEN);
-	strncpy(cur->maploc,seqi->maploc,NLEN);
-	strncpy(cur->seq,seqi->seq,SLEN);
-	init_qual(cur->qual,seqi->qual);
+	long slot;
+	if(target->size==0)
+		return -1;
+	slot=h&(target->size-1);
+	while(target->slots[slot]!=-1)
+	{
+		if((target->seqs[target->slots[slot]].hash==h)&&(strncmp(target->seqs[target->slots[slot]].seq,seq,SLEN)==0))
+			return target->slots[slot];
+		slot=(slot+1)&(target->size-1);
+	}
+	return -1;
+}
+
+long addseq(struct input*seqin,unsigned long h,struct miptarg*target,struct arena*mem,struct strtable*strs)
+{
+	long slot;
+	if(2*(target->nseqs+1)>target->size) //keep the table at most half full so probe sequences stay short
+		grow_seqs(target);
+	struct mipseq*cur=&(target->seqs[target->nseqs]);
+	cur->contig=intern(seqin->contig,mem,strs);
+	cur->maploc=intern(seqin->maploc,mem,strs);
+	cur->length=strnlen(seqin->seq,SLEN);
+	cur->seq=(char*)arena_alloc(mem,cur->length+1);
+	strncpy(cur->seq,seqin->seq,cur->length);
+	cur->seq[cur->length]='\0';
+	cur->qual=(unsigned int*)arena_alloc(mem,cur->length*sizeof(unsigned int));
+	init_qual(cur->qual,cur->length,seqin->qual);
 	cur->seqcount=1;
 	cur->tagcount=1;
-	cur->tags=(struct moltag*)malloc(sizeof(struct moltag));
-	strncpy(cur->tags->tag,seqi->tag,TLEN);
-	cur->tags->next=NULL;
-	cur->next=NULL;
-	return;
+	cur->hash=h;
+	init_tags(&(cur->tags));
+	addtag(seqin->tag,&(cur->tags));
+	slot=h&(target->size-1);
+	while(target->slots[slot]!=-1)
+		slot=(slot+1)&(target->size-1);
+	target->slots[slot]=target->nseqs;
+	target->nseqs++;
+	return target->nseqs-1;
 }
 
-void init_qual(double*curqual,char*newqual)
+void grow_seqs(struct miptarg*target)
 {
-	long q;
-	for(q=0;q<strlen(newqual);q++)
+	long s,slot;
+	target->size=(target->size==0)?MINSLOTS:2*target->size;
+	target->maxseqs=target->size/2;
+	target->seqs=(struct mipseq*)realloc(target->seqs,target->maxseqs*sizeof(struct mipseq));
+	free(target->slots);
+	target->slots=(long*)malloc(target->size*sizeof(long));
+	for(slot=0;slot<target->size;slot++)
+		target->slots[slot]=-1;
+	for(s=0;s<target->nseqs;s++)
 	{
-		curqual[q]=(double)newqual[q];
+		slot=target->seqs[s].hash&(target->size-1);
+		while(target->slots[slot]!=-1)
+			slot=(slot+1)&(target->size-1);
+		target->slots[slot]=s;
 	}
-	curqual[q]=0.0;
 	return;
 }
 
-void update(struct input*seqin,struct miptarg*targets,long index)
+void init_qual(unsigned int*curqual,long length,char*newqual)
 {
-	struct mipseq*current=targets[index].seqs;
-	while(strncmp(current->seq,seqin->seq,SLEN)!=0)
-		current=current->next;
-	udqual(current->qual,seqin->qual);
-	udmapping(current->contig,current->maploc,seqin->contig,seqin->maploc);
+	long q;
+	for(q=0;q<length;q++)
+		curqual[q]=0;
+	udqual(curqual,length,newqual);
+	return;
+}
+
+void update(struct input*seqin,struct mipseq*current,struct arena*mem,struct strtable*strs)
+{
+	udqual(current->qual,current->length,seqin->qual);
+	current->contig=udmapping(current->contig,seqin->contig,mem,strs);
+	current->maploc=udmapping(current->maploc,seqin->maploc,mem,strs);
 	current->seqcount++;
-	if(newtag(seqin->tag,current->tags))
-	{
-		udtags(seqin->tag,current->tags);
+	if(addtag(seqin->tag,&(current->tags)))
 		current->tagcount++;
-	}
 	return;
 }
 
-void udqual(double*curqual,char*newqual)
+void udqual(unsigned int*curqual,long length,char*newqual)
 {
 	long q;
-	for(q=0;q<strlen(newqual);q++)
+	for(q=0;(q<length)&&(newqual[q]!='\0');q++)
 	{
-		curqual[q]+=(double)newqual[q];
+		curqual[q]+=(unsigned char)newqual[q];
 	}
 	return;
 }
 
-void udmapping(char*curchr,char*curcoord,char*newchr,char*newcoord)
+char*udmapping(char*cur,char*new,struct arena*mem,struct strtable*strs)
+{
+	char joined[LLEN+1];
+	if(strstr(cur,new)!=NULL)
+		return cur;
+	snprintf(joined,LLEN+1,"%s/%s",cur,new);
+	return intern(joined,mem,strs);
+}
+
+void*arena_alloc(struct arena*mem,long nbytes)
+{
+	nbytes=(nbytes+7)&(~7L); //keep allocations aligned for quality sums
+	if(mem->used+nbytes>ABLOCK)
+	{
+		mem->blocks=(char**)realloc(mem->blocks,(mem->nblocks+1)*sizeof(char*));
+		mem->blocks[mem->nblocks]=(char*)malloc(ABLOCK);
+		mem->nblocks++;
+		mem->used=0;
+	}
+	mem->used+=nbytes;
+	return mem->blocks[mem->nblocks-1]+mem->used-nbytes;
+}
+
+char*intern(char*str,struct arena*mem,struct strtable*strs)
 {
-	if(strstr(curchr,newchr)==NULL)
+	long slot=hash_seq(str)&(strs->size-1);
+	char*interned;
+	while(strs->strs[slot]!=NULL)
 	{
-		strncat(curchr,"/",1);
-		strncat(curchr,newchr,strlen(newchr));
+		if(strcmp(strs->strs[slot],str)==0)
+			return strs->strs[slot];
+		slot=(slot+1)&(strs->size-1);
 	}
-	if(strstr(curcoord,newcoord)==NULL)
+	interned=(char*)arena_alloc(mem,strlen(str)+1);
+	strcpy(interned,str);
+	strs->strs[slot]=interned;
+	strs->nstrs++;
+	if(2*strs->nstrs>strs->size) //keep the table at most half full so probe sequences stay short
+		grow_strtable(strs);
+	return interned;
+}
+
+void grow_strtable(struct strtable*strs)
+{
+	char**oldstrs=strs->strs;
+	long oldsize=strs->size;
+	long i,slot;
+	strs->size=(oldsize==0)?MINSLOTS:2*oldsize;
+	strs->strs=(char**)calloc(strs->size,sizeof(char*));
+	for(i=0;i<oldsize;i++)
 	{
-		strncat(curcoord,"/",1);
-		strncat(curcoord,newcoord,strlen(newcoord));
+		if(oldstrs[i]!=NULL)
+		{
+			slot=hash_seq(oldstrs[i])&(strs->size-1);
+			while(strs->strs[slot]!=NULL)
+				slot=(slot+1)&(strs->size-1);
+			strs->strs[slot]=oldstrs[i];
+		}
 	}
+	free(oldstrs);
 	return;
 }
 
-int newtag(char*intag,struct moltag*taglist)
+int encode_tag(char*tag,unsigned short*code)
 {
-	struct moltag*cur=taglist;
-	while(cur!=NULL)
-  {
-    if(strncmp(cur->tag,intag,TLEN)==0)
-      return 0;
-    cur=cur->next;
-  }
-  return 1;
+	int i;
+	*code=0;
+	for(i=0;i<TLEN;i++) //TLEN is at most 8, so a tag fits in 16 bits
+	{
+		switch(tag[i])
+		{
+			case 'A': *code=(*code<<2); break;
+			case 'C': *code=(*code<<2)|1; break;
+			case 'G': *code=(*code<<2)|2; break;
+			case 'T': *code=(*code<<2)|3; break;
+			default: return 0;
+		}
+	}
+	return 1;
 }
 
-void udtags(char*intag,struct moltag*taglist)
+long hash_tag(unsigned short code,long size)
 {
-	struct moltag*cur=taglist;
-	while(cur->next!=NULL)
-		cur=cur->next;
-	cur->next=(struct moltag*)malloc(sizeof(struct moltag));
-	strncpy(cur->next->tag,intag,TLEN);
-	cur->next->next=NULL;
+	return (long)((code*11400714819323198485UL)>>32)&(size-1); //multiplicative (Fibonacci) hash
+}
+
+void init_tags(struct tagset*tset)
+{
+	tset->codes=NULL;
+	tset->used=NULL;
+	tset->size=0;
+	tset->ncodes=0;
+	tset->other=NULL;
 	return;
 }
 
-gzFile* init_output(gzFile*scounts,char*basename)
+int addtag(char*intag,struct tagset*tset)
 {
+	unsigned short code;
+	long slot;
+	struct moltag*cur;
+	if(!encode_tag(intag,&code))
+	{
+		for(cur=tset->other;cur!=NULL;cur=cur->next)
+		{
+			if(strncmp(cur->tag,intag,TLEN)==0)
+				return 0;
+		}
+		cur=(struct moltag*)malloc(sizeof(struct moltag));
+		strncpy(cur->tag,intag,TLEN);
+		cur->next=tset->other;
+		tset->other=cur;
+		return 1;
+	}
+	if(tset->size>0)
+	{
+		slot=hash_tag(code,tset->size);
+		while(tset->used[slot>>3]&(1<<(slot&7)))
+		{
+			if(tset->codes[slot]==code)
+				return 0;
+			slot=(slot+1)&(tset->size-1);
+		}
+	}
+	if(2*(tset->ncodes+1)>tset->size) //keep the table at most half full so probe sequences stay short
+		grow_tags(tset);
+	slot=hash_tag(code,tset->size);
+	while(tset->used[slot>>3]&(1<<(slot&7)))
+		slot=(slot+1)&(tset->size-1);
+	tset->codes[slot]=code;
+	tset->used[slot>>3]|=(1<<(slot&7));
+	tset->ncodes++;
+	return 1;
+}
+
+void grow_tags(struct tagset*tset)
+{
+	unsigned short*oldcodes=tset->codes;
+	unsigned char*oldused=tset->used;
+	long oldsize=tset->size;
+	long i,slot;
+	tset->size=(oldsize==0)?MINSLOTS:2*oldsize;
+	tset->codes=(unsigned short*)malloc(tset->size*sizeof(unsigned short));
+	tset->used=(unsigned char*)calloc(tset->size/8,1);
+	for(i=0;i<oldsize;i++)
+	{
+		if(oldused[i>>3]&(1<<(i&7)))
+		{
+			slot=hash_tag(oldcodes[i],tset->size);
+			while(tset->used[slot>>3]&(1<<(slot&7)))
+				slot=(slot+1)&(tset->size-1);
+			tset->codes[slot]=oldcodes[i];
+			tset->used[slot>>3]|=(1<<(slot&7));
+		}
+	}
+	free(oldcodes);
+	free(oldused);
+	return;
+}
+
+gzFile* init_output(char*basename)
+{
+	gzFile*scounts;
 	char outname[NLEN+1];
 	sprintf(outname,"%s%s",basename,".seqcounts.gz\0");
 	scounts=gzopen(outname,"w");
@@ -324,26 +669,25 @@ gzFile* init_output(gzFile*scounts,char*basename)
 
 void print_data(gzFile*scounts,char*samp,struct miptarg*targs,long numtargs)
 {
-	long m;
+	long m,s;
 	char finalqual[SLEN+1];
 	struct mipseq*current;
 	for(m=0;m<numtargs;m++)
 	{
-		current=targs[m].seqs;
-		while(current!=NULL)
+		for(s=0;s<targs[m].nseqs;s++)
 		{
+			current=&(targs[m].seqs[s]);
 			gzprintf(scounts,"%s\t%s\t%s\t%s\t",samp,targs[m].mip,targs[m].miptype,targs[m].crispr);
-			gzprintf(scounts,"%s\t%s\t%s\t%s\t%ld\n",current->contig,current->maploc,current->seq,avgqual(current->qual,current->seqcount,current->seq,finalqual),current->tagcount);
-			current=current->next;
+			gzprintf(scounts,"%s\t%s\t%s\t%s\t%ld\n",current->contig,current->maploc,current->seq,avgqual(current->qual,current->seqcount,current->length,finalqual),current->tagcount);
 		}
 	}
 	return;
 }
 
-char*avgqual(double*curqual,long count,char*curseq,char*newqual)
+char*avgqual(unsigned int*curqual,long count,long length,char*newqual)
 {
 	long q;
-	for(q=0;q<strlen(curseq);q++)
+	for(q=0;q<length;q++)
 	{
 		newqual[q]=(char)(curqual[q]/count);
 	}
@@ -351,32 +695,301 @@ char*avgqual(double*curqual,long count,char*curseq,char*newqual)
 	return newqual;
 }
 
-void freeseqs(struct miptarg*targs,long numtargs)
+gzFile* init_finalseqs(char*basename,long dp,double af,char*afstr)
 {
-	long m;
-	struct mipseq*temp;
+	gzFile*fseqs;
+	char outname[NLEN+31];
+	sprintf(outname,"%s%s%ld%s%.*lf%s",basename,".dp",dp,".af",(int)(strlen(afstr)-(strchr(afstr,'.')+1-afstr)),af,".finalseqs.gz\0");
+	fseqs=gzopen(outname,"w");
+	gzprintf(fseqs,"Sample\tMIP\tType\tCRISPR\tContig\tCoordinate\tSequence\tQuality\tTagCount\tAlleleFraction\n");
+	return fseqs;
+}
+
+FILE*init_mipcounts(char*basename)
+{
+	FILE*out;
+	char outname[NLEN+11];
+	sprintf(outname,"%s%s",basename,".mipcounts");
+	out=fopen(outname,"w");
+	fprintf(out,"Sample\tContig\tCoordinate\tMip_Type\tHaplotype_1_Count\tHaplotype_2_Count\n");
+	return out;
+}
+
+void call_seqs(gzFile*fseqs,FILE*mcounts,char*samp,struct miptarg*targs,long numtargs,long dp,double af,struct pairtable*ptab)
+{
+	long m,s,ntags,ncalled,count,maxseqs=0;
+	char finalqual[SLEN+1];
+	struct seqcall*calls=NULL;
+	struct mipseq*current;
 	for(m=0;m<numtargs;m++)
 	{
-		while(targs[m].seqs!=NULL)
+		if(targs[m].nseqs==0)
+			continue;
+
+		//sort sequences at the MIP target based on tag count numbers, then filter them based on molecular tag count depth and allele balance
+		if(targs[m].nseqs>maxseqs)
+		{
+			maxseqs=targs[m].nseqs;
+			calls=(struct seqcall*)realloc(calls,maxseqs*sizeof(struct seqcall));
+		}
+		for(s=0;s<targs[m].nseqs;s++)
+		{
+			calls[s].seq=&(targs[m].seqs[s]);
+			calls[s].tagcount=targs[m].seqs[s].tagcount;
+			calls[s].tagfreq=0.0;
+		}
+		qsort(calls,targs[m].nseqs,sizeof(struct seqcall),compfun);
+		filter_dp(calls,targs[m].nseqs,dp);
+		ntags=counttags(calls,targs[m].nseqs);
+		filter_af(calls,targs[m].nseqs,af,ntags);
+
+		//print remaining sequences to the finalseqs file
+		for(ncalled=0;(ncalled<targs[m].nseqs)&&(calls[ncalled].tagcount>0);ncalled++)
+		{
+			current=calls[ncalled].seq;
+			gzprintf(fseqs,"%s\t%s\t%s\t%s\t%s\t%s\t%s\t",samp,targs[m].mip,targs[m].miptype,targs[m].crispr,current->contig,current->maploc,current->seq);
+			gzprintf(fseqs,"%s\t%ld\t%lf\n",avgqual(current->qual,current->seqcount,current->length,finalqual),calls[ncalled].tagcount,calls[ncalled].tagfreq);
+		}
+
+		//if MIP is informative for copy number genotyping, print counts from the two most abundant remaining sequences to the mipcounts file
+		//(for MIPs on paired paralogs, add the counts to those of the MIP's pair instead)
+		if((ncalled>0)&&(informative(targs[m].miptype,samp)))
 		{
-			freetags(targs[m].seqs->tags);
-			temp=targs[m].seqs->next;
-			free(targs[m].seqs);
-			targs[m].seqs=temp;
+			count=calls[0].tagcount+((ncalled>1)?calls[1].tagcount:0);
+			if((ptab!=NULL)&&(add_pair_counts(ptab,calls[0].seq->contig,calls[0].seq->maploc,count)))
+				continue;
+			fprintf(mcounts,"%s\t%s\t%s\t%c\t%ld\t%ld\n",samp,calls[0].seq->contig,calls[0].seq->maploc,targs[m].miptype[0],calls[0].tagcount,(ncalled>1)?calls[1].tagcount:0);
 		}
 	}
+
+	//print paralog-specific counts for each pair of MIP targets
+	if(ptab!=NULL)
+		print_pairs(mcounts,samp,ptab);
+	free(calls);
 	return;
 }
 
-void freetags(struct moltag*taglist)
+int compfun(const void*p1,const void*p2)
 {
-	struct moltag*temp;
-	while(taglist!=NULL)
+	const struct seqcall*seq1=p1;
+	const struct seqcall*seq2=p2;
+	if(seq1->tagcount<seq2->tagcount)
+		return 1;
+	else if(seq2->tagcount<seq1->tagcount)
+		return -1;
+	else
+		return 0;
+}
+
+void filter_dp(struct seqcall*calls,long numseqs,long dp)
+{
+	long s;
+	for(s=0;s<numseqs;s++)
+	{
+		if(calls[s].tagcount<dp)
+			calls[s].tagcount=0;
+	}
+	return;
+}
+
+long counttags(struct seqcall*calls,long numseqs)
+{
+	long s,count=0;
+	for(s=0;s<numseqs;s++)
+		count+=calls[s].tagcount;
+	return count;
+}
+
+void filter_af(struct seqcall*calls,long numseqs,double af,long count)
+{
+	long s;
+	for(s=0;s<numseqs;s++)
+	{
+		calls[s].tagfreq=(double)calls[s].tagcount/(double)count;
+		if(calls[s].tagfreq<af)
+			calls[s].tagcount=0;
+	}
+	return;
+}
+
+int informative(char*miptype,char*samp)
+{
+	if((miptype[0]=='B')||((strstr(samp,"8330"))&&(miptype[0]=='E'))||((strstr(samp,"2069"))&&(miptype[0]=='M')))
+		return 1;
+	else
+		return 0;
+}
+
+struct pairtable*init_pairs(char*targsfile1,char*targsfile2)
+{
+	struct pairtable*ptab=(struct pairtable*)malloc(sizeof(struct pairtable));
+	struct paralogtarg*targs1,*targs2,*found,key;
+	long ntargs1,ntargs2,t;
+	char*match;
+
+	//read in MIP targets for both paralogs, and sort the second paralog's MIP targets by name
+	ntargs1=get_paralog_targs(targsfile1,&targs1);
+	ntargs2=get_paralog_targs(targsfile2,&targs2);
+	qsort(targs2,ntargs2,sizeof(struct paralogtarg),compare_names);
+	strcpy(ptab->contig1,(ntargs1>0)?targs1[0].contig:"");
+	strcpy(ptab->contig2,(ntargs2>0)?targs2[0].contig:"");
+
+	//pair each MIP target on the first paralog with the MIP target on the second paralog whose name has the second paralog's contig name in place of
+	//the first's (e.g., chrHYDIN_MIP_0001 and chrHYDIN2_MIP_0001)
+	ptab->npairs=ntargs1;
+	ptab->pairs=(struct mippair*)malloc(((ntargs1>0)?ntargs1:1)*sizeof(struct mippair));
+	for(t=0;t<ntargs1;t++)
+	{
+		ptab->pairs[t].coord1=targs1[t].coord;
+		ptab->pairs[t].coord2=-1; //MIP targets without a counterpart on the second paralog are given a count of 0 for it
+		ptab->pairs[t].count1=0;
+		ptab->pairs[t].count2=0;
+		match=strstr(targs1[t].name,ptab->contig1);
+		if((match==NULL)||(snprintf(key.name,NLEN+1,"%.*s%s%s",(int)(match-targs1[t].name),targs1[t].name,ptab->contig2,match+strlen(ptab->contig1))>NLEN))
+			continue;
+		found=(struct paralogtarg*)bsearch(&key,targs2,ntargs2,sizeof(struct paralogtarg),compare_names);
+		if(found!=NULL)
+			ptab->pairs[t].coord2=found->coord;
+	}
+
+	//index pairs by the target coordinate on each paralog so MIP targets read from the finalseqs file can be matched to their pairs
+	ptab->by1=(struct coordindex*)malloc(((ntargs1>0)?ntargs1:1)*sizeof(struct coordindex));
+	ptab->by2=(struct coordindex*)malloc(((ntargs1>0)?ntargs1:1)*sizeof(struct coordindex));
+	for(t=0;t<ntargs1;t++)
+	{
+		ptab->by1[t].coord=ptab->pairs[t].coord1;
+		ptab->by1[t].pair=t;
+		ptab->by2[t].coord=ptab->pairs[t].coord2;
+		ptab->by2[t].pair=t;
+	}
+	qsort(ptab->by1,ntargs1,sizeof(struct coordindex),compare_coords);
+	qsort(ptab->by2,ntargs1,sizeof(struct coordindex),compare_coords);
+	free(targs1);
+	free(targs2);
+	return ptab;
+}
+
+long get_paralog_targs(char*targsfile,struct paralogtarg**targs)
+{
+	long ntargs=0,maxtargs=256,start,armlength;
+	FILE*mtargs=fopen(targsfile,"r");
+	*targs=(struct paralogtarg*)malloc(maxtargs*sizeof(struct paralogtarg));
+	while(getc(mtargs)!='\n') //skip header line
+		continue;
+	while(fscanf(mtargs,"%200s %*s %200s %ld %*s %*s %*s %*s %ld %*s",(*targs)[ntargs].name,(*targs)[ntargs].contig,&start,&armlength)==4)
+	{
+		(*targs)[ntargs].coord=start+armlength; //coordinate of the first targeted base, as reported in the finalseqs file
+		ntargs++;
+		if(ntargs==maxtargs)
+		{
+			maxtargs*=2;
+			*targs=(struct paralogtarg*)realloc(*targs,maxtargs*sizeof(struct paralogtarg));
+		}
+	}
+	fclose(mtargs);
+	return ntargs;
+}
+
+int compare_names(const void*p1,const void*p2)
+{
+	const struct paralogtarg*targ1=p1;
+	const struct paralogtarg*targ2=p2;
+	return strcmp(targ1->name,targ2->name);
+}
+
+int compare_coords(const void*p1,const void*p2)
+{
+	const struct coordindex*index1=p1;
+	const struct coordindex*index2=p2;
+	return (index1->coord>index2->coord)-(index1->coord<index2->coord);
+}
+
+int add_pair_counts(struct pairtable*ptab,char*contig,char*maploc,long count)
+{
+	struct coordindex*index,*found,key;
+	char*end;
+	int para;
+	if(strcmp(contig,ptab->contig1)==0)
+	{
+		para=1;
+		index=ptab->by1;
+	}
+	else if(strcmp(contig,ptab->contig2)==0)
+	{
+		para=2;
+		index=ptab->by2;
+	}
+	else
+		return 0;
+
+	//find all pairs including a MIP target at the mapping coordinate (mapping coordinates that are not single numbers match no pair)
+	key.coord=strtol(maploc,&end,10);
+	if((end==maploc)||(*end!='\0'))
+		return 1;
+	found=bsearch(&key,index,ptab->npairs,sizeof(struct coordindex),compare_coords);
+	if(found==NULL)
+		return 1;
+	while((found>index)&&((found-1)->coord==key.coord))
+		found--;
+	for(;(found<index+ptab->npairs)&&(found->coord==key.coord);found++)
+	{
+		if(para==1)
+			ptab->pairs[found->pair].count1+=count;
+		else
+			ptab->pairs[found->pair].count2+=count;
+	}
+	return 1;
+}
+
+void print_pairs(FILE*out,char*samp,struct pairtable*ptab)
+{
+	long p;
+	for(p=0;p<ptab->npairs;p++)
+		fprintf(out,"%s\t%s\t%ld\tB\t%ld\t%ld\n",samp,ptab->contig1,ptab->pairs[p].coord1,ptab->pairs[p].count1,ptab->pairs[p].count2);
+	return;
+}
+
+void free_pairs(struct pairtable*ptab)
+{
+	free(ptab->pairs);
+	free(ptab->by1);
+	free(ptab->by2);
+	free(ptab);
+	return;
+}
+
+void freeseqs(struct miptarg*targs,long numtargs)
+{
+	long m,s;
+	for(m=0;m<numtargs;m++)
 	{
-		temp=taglist->next;
-		free(taglist);
-		taglist=temp;
+		for(s=0;s<targs[m].nseqs;s++)
+			freetags(&(targs[m].seqs[s].tags));
+		free(targs[m].seqs);
+		free(targs[m].slots);
 	}
 	return;
 }
 
+void free_arena(struct arena*mem)
+{
+	long b;
+	for(b=0;b<mem->nblocks;b++)
+		free(mem->blocks[b]);
+	free(mem->blocks);
+	return;
+}
+
+void freetags(struct tagset*tset)
+{
+	struct moltag*temp;
+	free(tset->codes);
+	free(tset->used);
+	while(tset->other!=NULL)
+	{
+		temp=tset->other->next;
+		free(tset->other);
+		tset->other=temp;
+	}
+	return;
+}
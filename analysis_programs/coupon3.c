@@ -1,75 +1,217 @@
 //Xander Nuttle
 //coupon3.c
-//Call: ./coupon3 (long)number_of_sets_to_complete_M (long)number_of_coupons_N (long)number_of_simulations_Z
+//Call: ./coupon3 (long)number_of_sets_to_complete_M (long)number_of_coupons_N (long)number_of_simulations_Z <(unsigned long)seed> <(int)num_threads>
+//  or: ./coupon3 M1,M2,... N1,N2,... (long)number_of_simulations_Z <(unsigned long)seed> <(int)num_threads>
 //
 //This program implements a Markov chain in order to simulate outcomes from the generalized coupon's collector problem,
 //namely, to simulate the number of coupons drawn to obtain M complete sets of N coupons. For PB experiments, this
 //same number can be interpreted as the number of PB integrations needed to obtain at least M integrations of each of
 //N gRNA constructs.
+//
+//The state of the chain is the number of coupons drawn at least m times, for m = 0 to M. Rather than stepping one draw at a
+//time, each simulation steps from one state change to the next: the number of draws of coupons already drawn M or more times
+//(which leave the state unchanged) before the next state change is drawn from a geometric distribution, and the state change
+//itself is drawn in proportion to the number of coupons drawn exactly 0 to M-1 times. Each simulation therefore takes exactly
+//M x N steps.
+//
+//Random numbers come from a Philox4x32-10 counter-based generator keyed by the seed, with a separate stream for each simulation
+//(the simulation index is part of the counter). Simulations are handed out to a pool of worker threads, and the results for a
+//given seed are identical for any number of threads. The optional seed defaults to the nanoseconds field of the current time,
+//and the optional number of threads defaults to the number of online processors.
+//
+//The expected number of draws is also computed exactly (to within about 1e-10 relative error) from the Newman-Shepp formula
+//E = N x integral from 0 to infinity of 1-(1-F_M(t))^N dt, where F_M(t) = exp(-t) x sum over k<M of t^k/k! is the probability
+//that a Poisson(t) variable is less than M. The integrand is evaluated in log space (F_M by log-sum-exp, the integrand as
+//-expm1(N x log1p(-F_M))) and integrated by adaptive Simpson quadrature over unit panels up to the point where N x F_M(t) is
+//negligible. It is printed after the simulation average, which serves as a cross-check; with Z = 0 no simulations are run.
+//
+//If M and/or N are given as comma-separated lists (e.g., "1,2,3" "1000,5000,10000"), a table of expected numbers of draws for
+//every (M, N) combination is printed instead (plus average simulated numbers of draws if Z > 0). All combinations are integrated
+//together: at each quadrature point, F_M(t) is computed once for every M by extending the sum for the previous M, and shared by
+//every N, and panels are subdivided until the integrals for all combinations have converged.
 
 #include<stdio.h>
-#include<gsl/gsl_rng.h>
-#include<gsl/gsl_randist.h>
 #include<stdlib.h>
 #include<string.h>
+#include<math.h>
+#include<stdint.h>
+#include<pthread.h>
+#include<unistd.h>
+#define PANEL 1.0 //width of the panels over which the expected draws integrand is adaptively integrated
+#define QTOL 1e-12 //absolute error tolerance for the integral over each panel
+#define QDEPTH 40 //maximum number of times a panel is halved
+
+//set up structure to store the state of a Philox4x32-10 random number stream
+struct philox
+{
+	uint32_t key[2];
+	uint32_t ctr[4];
+	uint32_t out[4];
+	int used; //number of words of out already used
+};
 
-const gsl_rng* setup_rng(const gsl_rng*random);
-long simcc(long numsets,long numcoupons,const gsl_rng*random);
+//set up structure to store data shared by the worker threads running simulations
+struct simjob
+{
+	long nsets;
+	long ncoupons;
+	long nsims;
+	unsigned long seed;
+	long*sims;
+	long next; //index of the next simulation to be run
+	pthread_mutex_t lock;
+};
+
+unsigned long setup_seed(void);
+void*run_sims(void*arg);
+long simcc(long numsets,long numcoupons,struct philox*random);
 void init_state(long*svec,long n_sets,long n_coupons);
-void setpaths(long n_sets,long n_coupons,long st[n_sets+1],long newsts[n_sets+1][n_sets+1],double p[n_sets+1]);
-void update_state(long n_sets,long st[n_sets+1],long newsts[n_sets+1][n_sets+1],unsigned int ivec[n_sets+1]);
+void init_stream(struct philox*random,unsigned long seed,long sim);
+void philox_round(uint32_t ctr[4],uint32_t key[2]);
+double uniform(struct philox*random);
 double avgsims(long n_sims,long simsvec[n_sims]);
+long count_values(char*values);
+void get_values(char*values,long*vec,long nvals);
+void expected_draws(long nm,long*msets,long nn,long*ncoups,double*expect);
+void integrand(double t,long nm,long*msets,long nn,long*ncoups,double*f);
+void adapt_simpson(double a,double b,long ng,long nm,long*msets,long nn,long*ncoups,double*fa,double*fm,double*fb,double*whole,double tol,int depth,double*sum);
+double simulate(long nsets,long ncoupons,long nsims,unsigned long seed,int nthreads);
 
 int main(int argc,char*argv[])
 {
-	//get desired numbers of sets (M), coupons (N), and simulations (Z) from the command line
-	long nsets=strtol(*(argv+1),NULL,10);
-	long ncoupons=strtol(*(argv+2),NULL,10);
+	//get desired numbers of sets (M), coupons (N), and simulations (Z) from the command line (M and N may be comma-separated lists)
+	long nm=count_values(*(argv+1));
+	long nn=count_values(*(argv+2));
+	long*msets=(long*)malloc(nm*sizeof(long));
+	long*ncoups=(long*)malloc(nn*sizeof(long));
+	get_values(*(argv+1),msets,nm);
+	get_values(*(argv+2),ncoups,nn);
 	long nsims=strtol(*(argv+3),NULL,10);
 
-	//set up random number generator
-	const gsl_rng*r=setup_rng(r);	
+	//set up random number seed and number of threads
+	unsigned long seed=(argc>4)?strtoul(*(argv+4),NULL,10):setup_seed();
+	int nthreads=(argc>5)?strtol(*(argv+5),NULL,10):sysconf(_SC_NPROCESSORS_ONLN);
 
-	//set up array to store simulation outcomes and run simulations
-	long*sims=(long*)malloc(nsims*sizeof(long));
-	long z;
-	for(z=0;z<nsims;z++)
-		sims[z]=simcc(nsets,ncoupons,r);
+	//compute exact expected numbers of draws for all combinations of M and N
+	double*expect=(double*)malloc(nm*nn*sizeof(double));
+	expected_draws(nm,msets,nn,ncoups,expect);
+
+	//for a single combination, run simulations and report their average together with the exact expectation
+	long i,j;
+	double avgdraws;
+	if((nm==1)&&(nn==1))
+	{
+		if(nsims>0)
+		{
+			avgdraws=simulate(msets[0],ncoups[0],nsims,seed,nthreads);
+			printf("number of sets: %ld\nnumber of coupons: %ld\nnumber of simulations: %ld\naverage number of draws needed to complete sets: %lf\n",msets[0],ncoups[0],nsims,avgdraws);
+		}
+		else
+			printf("number of sets: %ld\nnumber of coupons: %ld\n",msets[0],ncoups[0]);
+		printf("expected number of draws needed to complete sets: %lf\n",expect[0]);
+	}
 
-	//calculate average of simulation outsomes and report results
-	double avgdraws=avgsims(nsims,sims);	
-	printf("number of sets: %ld\nnumber of coupons: %ld\nnumber of simulations: %ld\naverage number of draws needed to complete sets: %lf\n",nsets,ncoupons,nsims,avgdraws);
+	//for a grid of combinations, report a table of exact expectations (and simulation averages)
+	else
+	{
+		printf((nsims>0)?"Sets\tCoupons\tExpected_draws\tSimulated_draws\n":"Sets\tCoupons\tExpected_draws\n");
+		for(i=0;i<nm;i++)
+		{
+			for(j=0;j<nn;j++)
+			{
+				printf("%ld\t%ld\t%lf",msets[i],ncoups[j],expect[i*nn+j]);
+				if(nsims>0)
+					printf("\t%lf",simulate(msets[i],ncoups[j],nsims,seed,nthreads));
+				printf("\n");
+			}
+		}
+	}
 
 	//clean up and exit
-	free(sims);
+	free(msets);
+	free(ncoups);
+	free(expect);
 	return 0;
 }
 
-const gsl_rng* setup_rng(const gsl_rng*random)
+double simulate(long nsets,long ncoupons,long nsims,unsigned long seed,int nthreads)
+{
+	if(nthreads<1)
+		nthreads=1;
+	if(nthreads>nsims)
+		nthreads=(nsims>0)?nsims:1;
+
+	//set up array to store simulation outcomes and run simulations (simulations are handed out to worker threads one at a time)
+	long*sims=(long*)malloc(((nsims>0)?nsims:1)*sizeof(long));
+	struct simjob job={nsets,ncoupons,nsims,seed,sims,0,PTHREAD_MUTEX_INITIALIZER};
+	pthread_t*workers=(pthread_t*)malloc(nthreads*sizeof(pthread_t));
+	long t;
+	for(t=0;t<nthreads;t++)
+		pthread_create(&(workers[t]),NULL,run_sims,&job);
+	for(t=0;t<nthreads;t++)
+		pthread_join(workers[t],NULL);
+
+	//calculate average of simulation outsomes
+	double avgdraws=avgsims(nsims,sims);
+	free(workers);
+	free(sims);
+	return avgdraws;
+}
+
+unsigned long setup_seed(void)
 {
 	unsigned long seed;
 	FILE*seedin;
-	random=gsl_rng_alloc(gsl_rng_mt19937);
 	seedin=popen("date +%N","r");
 	fscanf(seedin,"%lu",&seed);
 	pclose(seedin);
-	gsl_rng_set(random,seed);	
-	return random;
+	return seed;
+}
+
+void*run_sims(void*arg)
+{
+	struct simjob*job=(struct simjob*)arg;
+	struct philox random;
+	long z;
+	while(1)
+	{
+		pthread_mutex_lock(&(job->lock));
+		z=job->next++;
+		pthread_mutex_unlock(&(job->lock));
+		if(z>=job->nsims)
+			break;
+		init_stream(&random,job->seed,z);
+		job->sims[z]=simcc(job->nsets,job->ncoupons,&random);
+	}
+	return NULL;
 }
 
-long simcc(long numsets,long numcoupons,const gsl_rng*random)
+long simcc(long numsets,long numcoupons,struct philox*random)
 {
 	long ndraws=0;
 	long state[numsets+1];
-	long newstates[numsets+1][numsets+1];
-	double probs[numsets+1];
-	unsigned int newst_indx[numsets+1];
+	long s,progress;
+	double stay,target;
 	init_state(state,numsets,numcoupons);
 	while(state[numsets]<numcoupons) //all sets completed when last set has all coupons
 	{
-		setpaths(numsets,numcoupons,state,newstates,probs);
-		gsl_ran_multinomial(random,numsets+1,1,probs,newst_indx);
-		update_state(numsets,state,newstates,newst_indx);
+		//count draws of coupons already drawn M or more times before the next state change
+		stay=(double)state[numsets]/numcoupons;
+		if(stay>0)
+			ndraws+=(long)floor(log(1.0-uniform(random))/log(stay));
+
+		//choose the set to be incremented: set s gains a coupon with probability proportional to the number of coupons drawn exactly s-1 times
+		progress=numcoupons-state[numsets];
+		target=uniform(random)*progress;
+		for(s=1;s<numsets;s++)
+		{
+			target-=state[s-1]-state[s];
+			if(target<0)
+				break;
+		}
+		while(state[s-1]==state[s]) //guard against rounding choosing a set that cannot be incremented
+			s--;
+		state[s]++;
 		ndraws++;
 	}
 	return ndraws;
@@ -84,44 +226,190 @@ void init_state(long*svec,long n_sets,long n_coupons)
 	return;
 }
 
-void setpaths(long n_sets,long n_coupons,long st[n_sets+1],long newsts[n_sets+1][n_sets+1],double p[n_sets+1])
+void init_stream(struct philox*random,unsigned long seed,long sim)
 {
-	long s,m;
-	s=0; //new state 0: remain in same state
-	for(m=0;m<(n_sets+1);m++)
-		newsts[s][m]=st[m];
-	p[s]=(double)st[n_sets]/n_coupons;
-	for(s=1;s<(n_sets+1);s++) //new states 1-M: transition to a new state with set s incremented by 1
-	{
-		for(m=0;m<(n_sets+1);m++)
-			newsts[s][m]=st[m];
-		newsts[s][s]++;
-		p[s]=(double)(st[s-1]-st[s])/n_coupons;
-	}
+	random->key[0]=(uint32_t)seed;
+	random->key[1]=(uint32_t)(seed>>32);
+	random->ctr[0]=0;
+	random->ctr[1]=0;
+	random->ctr[2]=(uint32_t)sim;
+	random->ctr[3]=(uint32_t)((unsigned long)sim>>32);
+	random->used=4;
 	return;
 }
 
-void update_state(long n_sets,long st[n_sets+1],long newsts[n_sets+1][n_sets+1],unsigned int ivec[n_sets+1])
+void philox_round(uint32_t ctr[4],uint32_t key[2])
 {
-	long s,m;
-	for(s=0;s<(n_sets+1);s++)
+	uint64_t p0=(uint64_t)0xD2511F53*ctr[0];
+	uint64_t p1=(uint64_t)0xCD9E8D57*ctr[2];
+	uint32_t c1=ctr[1],c3=ctr[3];
+	ctr[0]=(uint32_t)(p1>>32)^c1^key[0];
+	ctr[1]=(uint32_t)p1;
+	ctr[2]=(uint32_t)(p0>>32)^c3^key[1];
+	ctr[3]=(uint32_t)p0;
+	return;
+}
+
+double uniform(struct philox*random)
+{
+	//generate four new words (ten Philox rounds of the current counter) when the previous ones have been used, then advance the counter
+	int r;
+	uint32_t key[2];
+	if(random->used>2)
 	{
-		if(ivec[s]==1)
+		memcpy(random->out,random->ctr,sizeof(random->out));
+		key[0]=random->key[0];
+		key[1]=random->key[1];
+		for(r=0;r<10;r++)
 		{
-			for(m=0;m<(n_sets+1);m++)
-				st[m]=newsts[s][m];
-			break;
+			philox_round(random->out,key);
+			key[0]+=0x9E3779B9;
+			key[1]+=0xBB67AE85;
 		}
+		if(++(random->ctr[0])==0)
+			random->ctr[1]++;
+		random->used=0;
 	}
-	return;
+
+	//combine two words into a double in [0,1) with 53 random bits
+	uint32_t a=random->out[random->used]>>5,b=random->out[random->used+1]>>6;
+	random->used+=2;
+	return (a*67108864.0+b)/9007199254740992.0;
 }
 
 double avgsims(long n_sims,long simsvec[n_sims])
 {
 	long long draws=0;
 	long s;
-	for(s=0;s<n_sims;s++)		
+	for(s=0;s<n_sims;s++)
 		draws+=simsvec[s];
   return (double)draws/(double)n_sims;
 }
 
+long count_values(char*values)
+{
+	long n=1;
+	for(;*values!='\0';values++)
+	{
+		if(*values==',')
+			n++;
+	}
+	return n;
+}
+
+void get_values(char*values,long*vec,long nvals)
+{
+	long v;
+	char*value=strtok(values,",");
+	for(v=0;v<nvals;v++)
+	{
+		vec[v]=strtol(value,NULL,10);
+		value=strtok(NULL,",");
+	}
+	return;
+}
+
+void expected_draws(long nm,long*msets,long nn,long*ncoups,double*expect)
+{
+	long ng=nm*nn,g,i,j,mmax=0,nmax=0;
+	for(i=0;i<nm;i++)
+		mmax=(msets[i]>mmax)?msets[i]:mmax;
+	for(j=0;j<nn;j++)
+		nmax=(ncoups[j]>nmax)?ncoups[j]:nmax;
+
+	//find where the integrand becomes negligible for every combination (it is close to N x F_M(t), largest for the largest M and N)
+	double tmax=ceil(log((double)nmax+1.0))+mmax;
+	double ftail;
+	while(1)
+	{
+		integrand(tmax,1,&mmax,1,&nmax,&ftail);
+		if(ftail<1e-18)
+			break;
+		tmax+=PANEL;
+	}
+
+	//integrate over each panel, refining adaptively until all combinations have converged
+	double fa[ng],fm[ng],fb[ng],whole[ng],sum[ng];
+	double a,b;
+	for(g=0;g<ng;g++)
+		sum[g]=0.0;
+	integrand(0.0,nm,msets,nn,ncoups,fa);
+	for(a=0.0;a<tmax;a=b)
+	{
+		b=a+PANEL;
+		integrand((a+b)/2,nm,msets,nn,ncoups,fm);
+		integrand(b,nm,msets,nn,ncoups,fb);
+		for(g=0;g<ng;g++)
+			whole[g]=(b-a)*(fa[g]+4*fm[g]+fb[g])/6;
+		adapt_simpson(a,b,ng,nm,msets,nn,ncoups,fa,fm,fb,whole,QTOL,0,sum);
+		memcpy(fa,fb,sizeof(fa));
+	}
+	for(i=0;i<nm;i++)
+	{
+		for(j=0;j<nn;j++)
+			expect[i*nn+j]=ncoups[j]*sum[i*nn+j];
+	}
+	return;
+}
+
+void integrand(double t,long nm,long*msets,long nn,long*ncoups,double*f)
+{
+	//calculate log F_M(t) for each M by extending the log-sum-exp of the Poisson(t) probabilities of 0 to k-1 for each k up to the largest M
+	long i,j,k,mmax=0;
+	for(i=0;i<nm;i++)
+		mmax=(msets[i]>mmax)?msets[i]:mmax;
+	double logf[mmax+1],term,peak=-t,scaled=1.0;
+	logf[0]=-INFINITY;
+	for(k=0;k<mmax;k++)
+	{
+		if(k>0)
+		{
+			term=(t>0)?k*log(t)-lgamma(k+1.0)-t:-INFINITY;
+			if(term>peak)
+			{
+				scaled=scaled*exp(peak-term)+1.0;
+				peak=term;
+			}
+			else
+				scaled+=exp(term-peak);
+		}
+		logf[k+1]=peak+log(scaled);
+	}
+
+	//calculate 1-(1-F_M(t))^N for each combination
+	double fm;
+	for(i=0;i<nm;i++)
+	{
+		fm=(msets[i]>0)?exp(logf[msets[i]]):0.0;
+		if(fm>1.0)
+			fm=1.0;
+		for(j=0;j<nn;j++)
+			f[i*nn+j]=(fm<1.0)?-expm1(ncoups[j]*log1p(-fm)):1.0;
+	}
+	return;
+}
+
+void adapt_simpson(double a,double b,long ng,long nm,long*msets,long nn,long*ncoups,double*fa,double*fm,double*fb,double*whole,double tol,int depth,double*sum)
+{
+	//evaluate Simpson's rule on each half of the interval and accept the refined estimates if they agree with the whole for every combination
+	double m=(a+b)/2,flm[ng],frm[ng],left[ng],right[ng],err,maxerr=0.0;
+	long g;
+	integrand((a+m)/2,nm,msets,nn,ncoups,flm);
+	integrand((m+b)/2,nm,msets,nn,ncoups,frm);
+	for(g=0;g<ng;g++)
+	{
+		left[g]=(m-a)*(fa[g]+4*flm[g]+fm[g])/6;
+		right[g]=(b-m)*(fm[g]+4*frm[g]+fb[g])/6;
+		err=fabs(left[g]+right[g]-whole[g]);
+		maxerr=(err>maxerr)?err:maxerr;
+	}
+	if((maxerr<=15*tol)||(depth>=QDEPTH))
+	{
+		for(g=0;g<ng;g++)
+			sum[g]+=left[g]+right[g]+(left[g]+right[g]-whole[g])/15;
+		return;
+	}
+	adapt_simpson(a,m,ng,nm,msets,nn,ncoups,fa,flm,fm,left,tol/2,depth+1,sum);
+	adapt_simpson(m,b,ng,nm,msets,nn,ncoups,fm,frm,fb,right,tol/2,depth+1,sum);
+	return;
+}
@@ -1,6 +1,7 @@
 //Xander Nuttle
 //detail_mip_targets_v5.c
 //Call: ./detail_mip_targets_v5 mip_sequences_file contig_fasta_file <snvs_bedgraph_file.snvs> <crispr_sites.crispr> <(long)coord>
+//  or: ./detail_mip_targets_v5 mip_sequences_file multi_fasta_file contig_coords_file.coords <snvs_bedgraph_file.snvs> <crispr_sites.crispr> <(int)num_threads>
 //
 //Generates a ".miptargets" file containing information regarding a set of input MIPs and their associated targets within a contig sequence.
 //
@@ -10,16 +11,44 @@
 //is tailored to this purpose and is used by other programs in my automated MIP analysis pipeline.
 //
 //To annotate MIP targets with respect to SNVs in MGH2069 and GM08330 cell lines and/or with respect to guide RNA cut sites and/or
-//prime editing sites, files ending in ".snvs" and ".crispr" can be used as optional inputs. These inputs must be sorted by chromosomal
-//coordinate (column 2) or else MIP targets may not get annotated properly. If any of these optional input files are used, the program
+//prime editing sites, files ending in ".snvs" and ".crispr" can be used as optional inputs. These inputs need not be sorted; both tables
+//are sorted by chromosome and coordinate when they are read in, and the SNVs and CRISPR targets within each MIP target are found by binary
+//search (CRISPR targets with the same coordinate are listed in input file order). If any of these optional input files are used, the program
 //requires a final command line argument specifying the chromosomal coordinate corresponding to the first base of the contig sequence.
+//
+//The hybridization arms of all MIPs are compiled into a single Aho-Corasick automaton, and every occurrence of every arm is found in one
+//pass over the contig sequence (and, only if some MIPs are not found there, one pass over its reverse complement). Each MIP's target is the
+//first extension arm occurrence followed within MSIZE bases by a ligation arm occurrence. MIPs whose targets cannot be found are reported
+//and given a start and end of 0.
+//
+//The contig fasta file is memory-mapped and its sequence is stored 2-bit packed, with a separate bit mask marking bases other than a, c, g,
+//or t, so there is no limit on contig length and memory use is proportional to it. If a samtools fasta index (contig_fasta_file.fai) is
+//present, the first record's name, length, and offset are taken from it; otherwise they are found by scanning the file. The reverse
+//complement of the contig is never stored; it is read by walking the packed sequence backwards.
+//
+//In the second (batch) form, which is used when the third argument is a ".coords" file (contig name, chromosome, and chromosomal coordinate
+//of the contig's first base on each line, as in a panel's .coords file), every contig in a multi-fasta file is annotated in one run. Each MIP
+//is reported for every contig in which its target is found, and MIPs are numbered within each contig in the order they appear in the MIP
+//sequences file. SNVs and CRISPR targets are assigned to contigs by chromosome (column 1) and coordinate, so a single .snvs and a single
+//.crispr file can cover the whole panel; contigs missing from the .coords file are not annotated with respect to them. Contigs are handed
+//out to a pool of worker threads one at a time, each contig being annotated by a single thread (the optional numeric argument sets the
+//number of threads; default: the number of online processors). Output is a combined file named after the fasta file (e.g., panel.fasta
+//yields panel.miptargets) listing contigs in fasta order, plus one file per contig (contig.miptargets) as in the first form.
 
 #include<stdio.h>
 #include<stdlib.h>
 #include<string.h>
+#include<ctype.h>
+#include<fcntl.h>
+#include<unistd.h>
+#include<sys/mman.h>
+#include<sys/stat.h>
+#include<pthread.h>
 #define SLEN 200 //size of character vectors for storing names, etc.
-#define CLEN 20000000 //size of character vector for storing contig sequences (max contig size = 20 Mb)
 #define MSIZE 200 //maximum distance between MIP arms in contig sequence for intervening sequence to be considered a valid MIP target
+#define ASIZE 5 //size of the alphabet used by the arm automaton (a, c, g, t, and anything else)
+#define KRED "\x1B[31m"
+#define KNRM "\x1B[0m"
 
 //set up structure to store MIP information
 struct mip
@@ -40,16 +69,71 @@ struct mip
 struct contig
 {
 	char name[SLEN+1];
-	char seq[CLEN+1];
-	char seqrc[CLEN+1];
+	unsigned char*bases; //2-bit packed sequence (a=0, c=1, g=2, t=3), four bases per byte
+	unsigned char*nmask; //one bit per base, set for bases other than a, c, g, or t
 	long length;
 };
 
+//set up structure to store the location of each record's sequence within a memory-mapped fasta file
+struct faentry
+{
+	char name[SLEN+1];
+	long length; //number of bases, or -1 if not known from a fasta index
+	long offset; //offset of the first byte of sequence
+	long end; //offset just past the last byte of sequence
+};
+
+//set up structure to store a memory-mapped fasta file and its records
+struct fasta
+{
+	int fd;
+	char*text;
+	long size;
+	struct faentry*recs;
+	long nrecs;
+};
+
+//set up structure to store the chromosomal location of a contig
+struct contigcoords
+{
+	char contig[SLEN+1];
+	char chr[SLEN+1];
+	long start;
+};
+
+//set up structure to store the names of chromosomes referred to by SNV and CRISPR target tables
+struct chrlist
+{
+	char(*names)[SLEN+1];
+	long n;
+	long size;
+};
+
+//set up structure to store an Aho-Corasick automaton of MIP arm sequences (arm 2m is the extension arm of MIP m, arm 2m+1 its ligation arm)
+struct armautomaton
+{
+	long*trans; //ASIZE transitions per node; node 0 is the root
+	long*dict; //nearest node along failure links at which some arm ends, or 0 if none
+	long*out; //first arm ending at each node, or -1 if none
+	long*outnext; //next arm ending at the same node as each arm, or -1 if none
+	long*armlen;
+	long nnodes;
+};
+
+//set up structure to store the locations (base0) at which an arm occurs in a sequence
+struct armhits
+{
+	long*locs;
+	long n;
+	long size;
+};
+
 //set up structure to store SNV information
 struct snvtable
 {
 	long coord;
 	char type;
+	long chr; //index of chromosome in the chromosome list (batch mode only)
 };
 
 //set up structure to store CRISPR target information
@@ -57,22 +141,67 @@ struct crtarg
 {
 	double coord;
 	char name[SLEN+1];	
+	long chr; //index of chromosome in the chromosome list (batch mode only)
+	long order; //line number in the input file, so that targets with the same coordinate keep their input order when sorted
+};
+
+//set up structure to store data shared by the worker threads annotating contigs in batch mode
+struct annotjob
+{
+	struct fasta*fa;
+	long next; //index of the next contig to be annotated
+	pthread_mutex_t lock;
+	struct armautomaton*ac;
+	struct mip*mips;
+	long nummips;
+	int*anyfound; //whether each MIP's target has been found in any contig
+	struct snvtable*snps;
+	long numsnvs;
+	struct crtarg*targs;
+	long numtargs;
+	struct contigcoords*coords;
+	long ncoords;
+	struct chrlist*chrs;
+	struct mip**cmips; //MIPs targeting each contig
+	long*ncmips;
 };
 
 long count_mips(FILE*mseqs);
 void get_mipseqs(FILE*mseqs,struct mip*mipinfo);
-void get_seq(FILE*fa,struct contig*c);
-void revcomp(char string[]);
+void open_fasta(char*faname,struct fasta*fa);
+long read_fai(char*faname,struct faentry**recs);
+long scan_fasta(struct fasta*fa);
+void close_fasta(struct fasta*fa);
+void get_seq(struct fasta*fa,long r,struct contig*c);
+void pack_seq(char*text,long textlen,long length,struct contig*c);
+int contig_base(struct contig*c,long loc);
 long count_snvs(FILE*bgraph);
-void get_snvs(FILE*bgraph,struct snvtable*snps,long cstart);
+void get_snvs(FILE*bgraph,struct snvtable*snps,long cstart,struct chrlist*chrs);
 long count_crtargs(FILE*crinfo);
-void get_crtargs(FILE*crinfo,struct crtarg*targs,long cstart);
+void get_crtargs(FILE*crinfo,struct crtarg*targs,long cstart,struct chrlist*chrs);
+int compare_snvs(const void*a,const void*b);
+int compare_crtargs(const void*a,const void*b);
+long find_snv(struct snvtable*snps,long nsnps,long chr,long coord);
+long find_crtarg(struct crtarg*targs,long ntargs,long chr,double coord);
+long chr_index(struct chrlist*chrs,char*name,int add);
+long count_coords(FILE*cinfo);
+void get_coords(FILE*cinfo,struct contigcoords*coords);
 void detail_mip(struct mip*mipinfo,struct contig*c,struct snvtable*snps,struct crtarg*targs,long nummips,long numsnvs,long numtargs);
-void findtarg(struct mip*mipdata,long mnum,struct contig*sequence);
-void classify(struct mip*mipdata,long mnum,struct snvtable*snvdata,long nsnps);
-void annotate(struct mip*mipdata,long mnum,struct crtarg*targdata,long ntargs);
-FILE*init_output(FILE*out,struct contig*c);
+void findtargs(struct mip*mipdata,long nummips,struct contig*sequence);
+long locate_targs(struct armautomaton*ac,struct mip*mipdata,long nummips,struct contig*sequence,int*found);
+void build_automaton(struct armautomaton*ac,struct mip*mipdata,long nummips);
+void free_automaton(struct armautomaton*ac);
+int base_index(char base);
+void scan_arms(struct armautomaton*ac,struct contig*c,int rc,struct armhits*hits,int*found);
+void add_hit(struct armhits*hits,long loc);
+int pair_arms(struct armhits*exthits,struct armhits*lighits,long*extloc,long*ligloc);
+void get_arms(char*mipseq,char*ext,char*lig);
+void classify(struct mip*mipdata,long mnum,struct snvtable*snvdata,long nsnps,long chr,long offset);
+void annotate(struct mip*mipdata,long mnum,struct crtarg*targdata,long ntargs,long chr,long offset);
+FILE*init_output(char*name);
 void print_data(FILE*out,struct mip*mipdata,long nummips);
+void batch_detail(char*argv[],int argc,struct mip*mips,long nmips);
+void*annotate_contigs(void*arg);
 
 int main(int argc,char*argv[])
 {
@@ -85,13 +214,24 @@ int main(int argc,char*argv[])
 	//read in MIP sequences
 	get_mipseqs(mipseqs,mips);
 
+	//in batch mode, annotate every contig in the fasta file and exit
+	if((argc>3)&&(strstr(*(argv+3),"coords")!=NULL))
+	{
+		batch_detail(argv,argc,mips,nmips);
+		free(mips);
+		fclose(mipseqs);
+		return 0;
+	}
+
 	//allocate memory to store contig information
 	struct contig*chr;
 	chr=(struct contig*)malloc(sizeof(struct contig));	
 
-	//read in contig sequence from fasta file, generate its reverse complements, and calculate its length
-	FILE*fasta=fopen(*(argv+2),"r");
-	get_seq(fasta,chr);
+	//read in contig sequence from fasta file and determine its length
+	struct fasta fa;
+	open_fasta(*(argv+2),&fa);
+	get_seq(&fa,0,chr);
+	close_fasta(&fa);
 
 	//determine whether input includes file with locations of SNVs
 	int snvinput=0;
@@ -117,7 +257,7 @@ int main(int argc,char*argv[])
 		bedgraph=fopen(*(argv+3),"r");
 		nsnvs=count_snvs(bedgraph);
 		snvs=(struct snvtable*)malloc(nsnvs*sizeof(struct snvtable));
-		get_snvs(bedgraph,snvs,coord);
+		get_snvs(bedgraph,snvs,coord,NULL);
 	}
 
 	//determine the number of CRISPR targets, allocate memory to store CRISPR target information, and read in CRISPR target information from input file
@@ -129,23 +269,24 @@ int main(int argc,char*argv[])
 		crfile=fopen(*(argv+argc-2),"r");
 		ncrispr=count_crtargs(crfile);
 		crtargs=(struct crtarg*)malloc(ncrispr*sizeof(struct crtarg));
-		get_crtargs(crfile,crtargs,coord);
+		get_crtargs(crfile,crtargs,coord,NULL);
 	}
 
 	//get data for each MIP
 	detail_mip(mips,chr,snvs,crtargs,nmips,nsnvs,ncrispr);
 
 	//set up output file
-	FILE*miptargets=init_output(miptargets,chr);	
+	FILE*miptargets=init_output(chr->name);	
 
 	//print MIP data to output	
 	print_data(miptargets,mips,nmips);
 
 	//clean up and exit
 	free(mips);
+	free(chr->bases);
+	free(chr->nmask);
 	free(chr);
 	fclose(mipseqs);
-	fclose(fasta);
 	if(snvinput)
 	{
 		fclose(bedgraph);
@@ -179,51 +320,156 @@ void get_mipseqs(FILE*mseqs,struct mip*mipinfo)
 	return;
 }
 
-void get_seq(FILE*fa,struct contig*c)
+void open_fasta(char*faname,struct fasta*fa)
 {
-	fscanf(fa,"%*c %s",c->name);	
-	long i=0;
-	char ch;
-	while((ch=getc(fa))!=EOF)
+	//map the fasta file into memory
+	fa->fd=open(faname,O_RDONLY);
+	struct stat fstats;
+	fstat(fa->fd,&fstats);
+	fa->size=fstats.st_size;
+	fa->text=(char*)mmap(NULL,(fa->size>0)?fa->size:1,PROT_READ,MAP_PRIVATE,fa->fd,0);
+
+	//locate each record's sequence using the fasta index if there is one, or by scanning the file otherwise
+	long r,end;
+	fa->nrecs=read_fai(faname,&(fa->recs));
+	if(fa->nrecs)
 	{
-		if(isalpha(ch))
+		for(r=0;r<fa->nrecs;r++)
+		{
+			for(end=fa->recs[r].offset;(end<fa->size)&&(fa->text[end]!='>');end++)
+				;
+			fa->recs[r].end=end;
+		}
+	}
+	else
+		fa->nrecs=scan_fasta(fa);
+	return;
+}
+
+long read_fai(char*faname,struct faentry**recs)
+{
+	char fainame[strlen(faname)+5];
+	sprintf(fainame,"%s.fai",faname);
+	FILE*fai=fopen(fainame,"r");
+	*recs=NULL;
+	if(fai==NULL)
+		return 0;
+	long nrecs=0,size=0;
+	char name[SLEN+1];
+	long length,offset;
+	while(fscanf(fai,"%s %ld %ld %*s %*s",name,&length,&offset)==3)
+	{
+		if(nrecs==size)
+		{
+			size=(size)?2*size:64;
+			*recs=(struct faentry*)realloc(*recs,size*sizeof(struct faentry));
+		}
+		strncpy((*recs)[nrecs].name,name,SLEN);
+		(*recs)[nrecs].length=length;
+		(*recs)[nrecs].offset=offset;
+		nrecs++;
+	}
+	fclose(fai);
+	return nrecs;
+}
+
+long scan_fasta(struct fasta*fa)
+{
+	long nrecs=0,size=0,i=0,n;
+	char*text=fa->text;
+	fa->recs=NULL;
+	while(i<fa->size)
+	{
+		//skip to the next header line
+		if(text[i]!='>')
 		{
-			c->seq[i]=tolower(ch);
 			i++;
+			continue;
+		}
+		if(nrecs==size)
+		{
+			size=(size)?2*size:64;
+			fa->recs=(struct faentry*)realloc(fa->recs,size*sizeof(struct faentry));
 		}
+
+		//record the name (header text up to the first whitespace) and the extent of the sequence
+		for(n=0,i++;(i<fa->size)&&(!(isspace(text[i])))&&(n<SLEN);i++,n++)
+			fa->recs[nrecs].name[n]=text[i];
+		fa->recs[nrecs].name[n]='\0';
+		while((i<fa->size)&&(text[i]!='\n'))
+			i++;
+		fa->recs[nrecs].offset=i;
+		while((i<fa->size)&&(text[i]!='>'))
+			i++;
+		fa->recs[nrecs].end=i;
+		fa->recs[nrecs].length=-1;
+		nrecs++;
 	}
-	c->seq[i]='\0';
-	strncpy(c->seqrc,c->seq,CLEN);
-	revcomp(c->seqrc);
-	c->length=strlen(c->seq);
+	return nrecs;
+}
+
+void close_fasta(struct fasta*fa)
+{
+	munmap(fa->text,(fa->size>0)?fa->size:1);
+	close(fa->fd);
+	free(fa->recs);
 	return;
 }
 
-void revcomp(char string[])
+void get_seq(struct fasta*fa,long r,struct contig*c)
 {
-	long a=strlen(string);
-	long b,c;
-	char base;
-	char newstring[a+1];
-	for(b=0;b<a;b++)
+	//determine the length of the record's sequence if it is not known from the fasta index
+	struct faentry*rec=&(fa->recs[r]);
+	long length=rec->length,i;
+	strncpy(c->name,rec->name,SLEN);
+	if(length<0)
 	{
-		newstring[b]=string[a-1-b];
+		length=0;
+		for(i=rec->offset;i<rec->end;i++)
+		{
+			if(isalpha(fa->text[i]))
+				length++;
+		}
 	}
-	for(c=0;c<a;c++)
+
+	//store the sequence 2-bit packed
+	pack_seq(fa->text+rec->offset,rec->end-rec->offset,length,c);
+	return;
+}
+
+void pack_seq(char*text,long textlen,long length,struct contig*c)
+{
+	long i,b=0;
+	int code;
+	c->bases=(unsigned char*)calloc(length/4+1,sizeof(unsigned char));
+	c->nmask=(unsigned char*)calloc(length/8+1,sizeof(unsigned char));
+	for(i=0;(i<textlen)&&(b<length);i++)
 	{
-		base=newstring[c];
-		switch(base)
+		if(!(isalpha(text[i])))
+			continue;
+		switch(tolower(text[i]))
 		{
-			case 'a': base='t'; break;
-			case 'c': base='g'; break;
-			case 'g': base='c'; break;
-			case 't': base='a'; break;
-			default: base='n'; break;
+			case 'a': code=0; break;
+			case 'c': code=1; break;
+			case 'g': code=2; break;
+			case 't': code=3; break;
+			default: code=4; break;
 		}
-		newstring[c]=base;
+		if(code==4)
+			c->nmask[b>>3]|=1<<(b&7);
+		else
+			c->bases[b>>2]|=code<<((b&3)<<1);
+		b++;
 	}
-	newstring[a]='\0';
-	strncpy(string,newstring,CLEN);
+	c->length=b;
+	return;
+}
+
+int contig_base(struct contig*c,long loc)
+{
+	if(c->nmask[loc>>3]&(1<<(loc&7)))
+		return 4;
+	return (c->bases[loc>>2]>>((loc&3)<<1))&3;
 }
 
 long count_snvs(FILE*bgraph)
@@ -238,13 +484,15 @@ long count_snvs(FILE*bgraph)
 	return numsnvs;
 }
 
-void get_snvs(FILE*bgraph,struct snvtable*snps,long cstart)
+void get_snvs(FILE*bgraph,struct snvtable*snps,long cstart,struct chrlist*chrs)
 {
 	long chrcoord,s=0;
 	int mgh,gm;
-	while(fscanf(bgraph,"%*s %*s %ld %d %d",&chrcoord,&mgh,&gm)==3)
+	char snvchr[SLEN+1];
+	while(fscanf(bgraph,"%s %*s %ld %d %d",snvchr,&chrcoord,&mgh,&gm)==4)
 	{
 		snps[s].coord=chrcoord-cstart+1;
+		snps[s].chr=(chrs!=NULL)?chr_index(chrs,snvchr,1):-1;
 		if((mgh)&&(gm))
 			snps[s].type='B';
 		else if(mgh)
@@ -253,6 +501,7 @@ void get_snvs(FILE*bgraph,struct snvtable*snps,long cstart)
 			snps[s].type='E';
 		s++;
 	}
+	qsort(snps,s,sizeof(struct snvtable),compare_snvs);
 	return;
 }
 
@@ -268,17 +517,110 @@ long count_crtargs(FILE*crinfo)
 	return numtargs;
 }
 
-void get_crtargs(FILE*crinfo,struct crtarg*targs,long cstart)
+void get_crtargs(FILE*crinfo,struct crtarg*targs,long cstart,struct chrlist*chrs)
 {
 	long t=0;
 	double chrcoord;
-	char targid[SLEN+1];
-	while(fscanf(crinfo,"%*s %lf %s",&chrcoord,targid)==2)
+	char targid[SLEN+1],crchr[SLEN+1];
+	while(fscanf(crinfo,"%s %lf %s",crchr,&chrcoord,targid)==3)
 	{
 		targs[t].coord=chrcoord-cstart+1;
 		strncpy(targs[t].name,targid,SLEN);
+		targs[t].chr=(chrs!=NULL)?chr_index(chrs,crchr,1):-1;
+		targs[t].order=t;
 		t++;
 	}
+	qsort(targs,t,sizeof(struct crtarg),compare_crtargs);
+	return;
+}
+
+int compare_snvs(const void*a,const void*b)
+{
+	const struct snvtable*s1=(const struct snvtable*)a;
+	const struct snvtable*s2=(const struct snvtable*)b;
+	if(s1->chr!=s2->chr)
+		return (s1->chr<s2->chr)?-1:1;
+	return (s1->coord>s2->coord)-(s1->coord<s2->coord);
+}
+
+int compare_crtargs(const void*a,const void*b)
+{
+	const struct crtarg*t1=(const struct crtarg*)a;
+	const struct crtarg*t2=(const struct crtarg*)b;
+	if(t1->chr!=t2->chr)
+		return (t1->chr<t2->chr)?-1:1;
+	if(t1->coord!=t2->coord)
+		return (t1->coord<t2->coord)?-1:1;
+	return (t1->order>t2->order)-(t1->order<t2->order);
+}
+
+long find_snv(struct snvtable*snps,long nsnps,long chr,long coord)
+{
+	//return the index of the first SNV at or after the given chromosome and coordinate
+	long lo=0,hi=nsnps,mid;
+	while(lo<hi)
+	{
+		mid=lo+(hi-lo)/2;
+		if((snps[mid].chr<chr)||((snps[mid].chr==chr)&&(snps[mid].coord<coord)))
+			lo=mid+1;
+		else
+			hi=mid;
+	}
+	return lo;
+}
+
+long find_crtarg(struct crtarg*targs,long ntargs,long chr,double coord)
+{
+	//return the index of the first CRISPR target at or after the given chromosome and coordinate
+	long lo=0,hi=ntargs,mid;
+	while(lo<hi)
+	{
+		mid=lo+(hi-lo)/2;
+		if((targs[mid].chr<chr)||((targs[mid].chr==chr)&&(targs[mid].coord<coord)))
+			lo=mid+1;
+		else
+			hi=mid;
+	}
+	return lo;
+}
+
+long chr_index(struct chrlist*chrs,char*name,int add)
+{
+	long i;
+	for(i=0;i<chrs->n;i++)
+	{
+		if(strcmp(chrs->names[i],name)==0)
+			return i;
+	}
+	if(!(add))
+		return -1;
+	if(chrs->n==chrs->size)
+	{
+		chrs->size=(chrs->size)?2*chrs->size:16;
+		chrs->names=(char(*)[SLEN+1])realloc(chrs->names,chrs->size*sizeof(*(chrs->names)));
+	}
+	strncpy(chrs->names[chrs->n],name,SLEN);
+	chrs->names[chrs->n][SLEN]='\0';
+	return chrs->n++;
+}
+
+long count_coords(FILE*cinfo)
+{
+	long numcontigs=0;
+	char contig[SLEN+1];
+	fpos_t pos;
+	fgetpos(cinfo,&pos);
+	while(fscanf(cinfo,"%s %*s %*s",contig)==1)
+		numcontigs++;
+	fsetpos(cinfo,&pos);
+	return numcontigs;
+}
+
+void get_coords(FILE*cinfo,struct contigcoords*coords)
+{
+	long c=0;
+	while(fscanf(cinfo,"%s %s %ld",coords[c].contig,coords[c].chr,&(coords[c].start))==3)
+		c++;
 	return;
 }
 
@@ -288,83 +630,282 @@ void detail_mip(struct mip*mipinfo,struct contig*c,struct snvtable*snps,struct c
 	for(m=0;m<nummips;m++)
 	{
 		//detemine MIP name and contig targeted
-		sprintf(mipinfo[m].name,"%s_MIP_%04ld",c->name,m+1);
+		if(snprintf(mipinfo[m].name,SLEN+1,"%s_MIP_%04ld",c->name,m+1)>SLEN)
+			printf(KRED "Name of MIP %ld truncated to %d characters.\n" KNRM,m+1,SLEN);
 		strncpy(mipinfo[m].chr,c->name,SLEN);
-		
-		//determine MIP start and end coordinates (base1), strand, length of targeting arm encountered first in sequence, and length of target sequence
-		findtarg(mipinfo,m,c);
+	}
+
+	//determine MIP start and end coordinates (base1), strand, length of targeting arm encountered first in sequence, and length of target sequence
+	findtargs(mipinfo,nummips,c);
 
+	for(m=0;m<nummips;m++)
+	{
 		//determine MIP type (designates whether MIP targets one or more SNVs present in MGH2069 and/or GM08330 genomes
-		classify(mipinfo,m,snps,numsnvs);
+		classify(mipinfo,m,snps,numsnvs,-1,0);
 		
 		//determine whether MIP target sequence includes one or more CRISPR sites
-		annotate(mipinfo,m,targs,numtargs);
+		annotate(mipinfo,m,targs,numtargs,-1,0);
+	}
+	return;
+}
+
+void findtargs(struct mip*mipdata,long nummips,struct contig*sequence)
+{
+	struct armautomaton ac;
+	build_automaton(&ac,mipdata,nummips);
+	int*found=(int*)calloc(nummips,sizeof(int));
+	locate_targs(&ac,mipdata,nummips,sequence,found);
+
+	//report MIPs whose targets were not found
+	long m;
+	for(m=0;m<nummips;m++)
+	{
+		if(found[m])
+			continue;
+		printf(KRED "No target found for %s (%s) in %s.\n" KNRM,mipdata[m].name,mipdata[m].seq,sequence->name);
+		mipdata[m].start=0;
+		mipdata[m].end=0;
+		mipdata[m].armlen=0;
+		mipdata[m].strand='.';
+		mipdata[m].targlen=0;
 	}
+	free(found);
+	free_automaton(&ac);
 	return;
 }
 
-void findtarg(struct mip*mipdata,long mnum,struct contig*sequence)
+long locate_targs(struct armautomaton*ac,struct mip*mipdata,long nummips,struct contig*sequence,int*found)
 {
-	char ext[SLEN+1],lig[SLEN+1];
-	long b;
-	for(b=0;b<SLEN;b++)
+	struct armhits*hits=(struct armhits*)calloc(2*nummips,sizeof(struct armhits));
+	long m,a,extloc,ligloc,extlen,liglen,nfound=0;
+	int rc;
+
+	//locate all arms in the contig sequence, then (only if needed) in its reverse complement, and pair them up for each MIP not yet found
+	for(rc=0;(rc<2)&&(nfound<nummips);rc++)
 	{
-		ext[b]='\0';
-		lig[b]='\0';
+		scan_arms(ac,sequence,rc,hits,found);
+		for(m=0;m<nummips;m++)
+		{
+			if(found[m]||(!(pair_arms(&hits[2*m],&hits[2*m+1],&extloc,&ligloc))))
+				continue;
+			found[m]=1;
+			nfound++;
+			extlen=ac->armlen[2*m];
+			liglen=ac->armlen[2*m+1];
+			if(!(rc))
+			{
+				mipdata[m].start=extloc+1;
+				mipdata[m].end=ligloc+liglen;
+				mipdata[m].armlen=extlen;
+				mipdata[m].strand='+';
+				mipdata[m].targlen=mipdata[m].end-mipdata[m].start+1-(extlen+liglen);
+			}
+			else
+			{
+				mipdata[m].start=sequence->length-(ligloc+liglen)+1;
+				mipdata[m].end=sequence->length-extloc;
+				mipdata[m].armlen=liglen;
+				mipdata[m].strand='-';
+				mipdata[m].targlen=mipdata[m].end-mipdata[m].start+1-(liglen+extlen);
+			}
+		}
+		for(a=0;a<2*nummips;a++)
+			hits[a].n=0;
 	}
-	int found=0,rc=0;
-	char*ligloc,*extloc,*searchloc;
-	strncpy(ext,strrchr(mipdata[mnum].seq,'N')+1,SLEN);
-	strncpy(lig,mipdata[mnum].seq,strchr(mipdata[mnum].seq,'C')-mipdata[mnum].seq);
-	searchloc=sequence->seq;	
-	while(!(found))
+
+	//clean up
+	for(a=0;a<2*nummips;a++)
+		free(hits[a].locs);
+	free(hits);
+	return nfound;
+}
+
+void build_automaton(struct armautomaton*ac,struct mip*mipdata,long nummips)
+{
+	char arm[2][SLEN+1];
+	long m,a,b,i,node,child,fail,head=0,tail=0,maxnodes=1;
+
+	//build a trie of all arm sequences
+	for(m=0;m<nummips;m++)
+	{
+		get_arms(mipdata[m].seq,arm[0],arm[1]);
+		maxnodes+=strlen(arm[0])+strlen(arm[1]);
+	}
+	ac->trans=(long*)malloc(maxnodes*ASIZE*sizeof(long));
+	ac->dict=(long*)calloc(maxnodes,sizeof(long));
+	ac->out=(long*)malloc(maxnodes*sizeof(long));
+	ac->outnext=(long*)malloc(2*nummips*sizeof(long));
+	ac->armlen=(long*)malloc(2*nummips*sizeof(long));
+	for(b=0;b<ASIZE;b++)
+		ac->trans[b]=-1;
+	ac->out[0]=-1;
+	ac->nnodes=1;
+	for(m=0;m<nummips;m++)
 	{
-		extloc=strstr(searchloc,ext);
-		if(extloc==NULL)
+		get_arms(mipdata[m].seq,arm[0],arm[1]);
+		for(a=0;a<2;a++)
 		{
-			searchloc=sequence->seqrc;
-			rc++;
-			continue;
+			ac->armlen[2*m+a]=strlen(arm[a]);
+			ac->outnext[2*m+a]=-1;
+			if(ac->armlen[2*m+a]==0)
+				continue;
+			node=0;
+			for(i=0;arm[a][i];i++)
+			{
+				b=base_index(arm[a][i]);
+				if(ac->trans[node*ASIZE+b]<0)
+				{
+					child=ac->nnodes++;
+					for(fail=0;fail<ASIZE;fail++)
+						ac->trans[child*ASIZE+fail]=-1;
+					ac->out[child]=-1;
+					ac->trans[node*ASIZE+b]=child;
+				}
+				node=ac->trans[node*ASIZE+b];
+			}
+			ac->outnext[2*m+a]=ac->out[node];
+			ac->out[node]=2*m+a;
 		}
-		searchloc=extloc+1;
-		while((ligloc=strstr(searchloc,lig))!=NULL)
+	}
+
+	//add failure transitions breadth-first so that the trie becomes a complete automaton, recording dictionary links along the way
+	long*queue=(long*)malloc(ac->nnodes*sizeof(long));
+	long*faillink=(long*)calloc(ac->nnodes,sizeof(long));
+	for(b=0;b<ASIZE;b++)
+	{
+		if(ac->trans[b]<0)
+			ac->trans[b]=0;
+		else
+			queue[tail++]=ac->trans[b];
+	}
+	while(head<tail)
+	{
+		node=queue[head++];
+		for(b=0;b<ASIZE;b++)
 		{
-			if((ligloc-extloc)<=MSIZE)
+			child=ac->trans[node*ASIZE+b];
+			if(child<0)
 			{
-				found++;
-				break;
+				ac->trans[node*ASIZE+b]=ac->trans[faillink[node]*ASIZE+b];
+				continue;
 			}
-			searchloc=ligloc+1;
+			fail=ac->trans[faillink[node]*ASIZE+b];
+			faillink[child]=fail;
+			ac->dict[child]=(ac->out[fail]>=0)?fail:ac->dict[fail];
+			queue[tail++]=child;
 		}
-		searchloc=extloc+1;
 	}
-	if(!(rc))
+	free(queue);
+	free(faillink);
+	return;
+}
+
+void free_automaton(struct armautomaton*ac)
+{
+	free(ac->trans);
+	free(ac->dict);
+	free(ac->out);
+	free(ac->outnext);
+	free(ac->armlen);
+	return;
+}
+
+int base_index(char base)
+{
+	switch(base)
 	{
-		mipdata[mnum].start=extloc-sequence->seq+1;
-		mipdata[mnum].end=ligloc-sequence->seq+strlen(lig);
-		mipdata[mnum].armlen=strlen(ext);
-		mipdata[mnum].strand='+';
-		mipdata[mnum].targlen=mipdata[mnum].end-mipdata[mnum].start+1-(mipdata[mnum].armlen+strlen(lig));
+		case 'a': return 0;
+		case 'c': return 1;
+		case 'g': return 2;
+		case 't': return 3;
+		default: return 4;
 	}
-	else
+}
+
+void scan_arms(struct armautomaton*ac,struct contig*c,int rc,struct armhits*hits,int*found)
+{
+	//walk the contig forwards, or backwards with bases complemented to read its reverse complement
+	long i,node,a,state=0;
+	int b;
+	for(i=0;i<c->length;i++)
 	{
-		mipdata[mnum].start=sequence->length-(ligloc-sequence->seqrc+strlen(lig))+1;
-		mipdata[mnum].end=sequence->length-(extloc-sequence->seqrc);
-		mipdata[mnum].armlen=strlen(lig);
-		mipdata[mnum].strand='-';
-		mipdata[mnum].targlen=mipdata[mnum].end-mipdata[mnum].start+1-(mipdata[mnum].armlen+strlen(ext));
+		if(rc)
+		{
+			b=contig_base(c,c->length-1-i);
+			b=(b<4)?3-b:4;
+		}
+		else
+			b=contig_base(c,i);
+		state=ac->trans[state*ASIZE+b];
+		for(node=(ac->out[state]>=0)?state:ac->dict[state];node>0;node=ac->dict[node])
+		{
+			for(a=ac->out[node];a>=0;a=ac->outnext[a])
+			{
+				if(!(found[a/2]))
+					add_hit(&hits[a],i-ac->armlen[a]+1);
+			}
+		}
 	}
 	return;
 }
 
-void classify(struct mip*mipdata,long mnum,struct snvtable*snvdata,long nsnps)
+void add_hit(struct armhits*hits,long loc)
 {
-	long s;
+	if(hits->n==hits->size)
+	{
+		hits->size=(hits->size)?2*hits->size:4;
+		hits->locs=(long*)realloc(hits->locs,hits->size*sizeof(long));
+	}
+	hits->locs[hits->n++]=loc;
+	return;
+}
+
+int pair_arms(struct armhits*exthits,struct armhits*lighits,long*extloc,long*ligloc)
+{
+	//for each extension arm occurrence in turn, check the first ligation arm occurrence starting after it
+	long e,l=0;
+	for(e=0;e<exthits->n;e++)
+	{
+		while((l<lighits->n)&&(lighits->locs[l]<=exthits->locs[e]))
+			l++;
+		if(l==lighits->n)
+			return 0;
+		if((lighits->locs[l]-exthits->locs[e])<=MSIZE)
+		{
+			*extloc=exthits->locs[e];
+			*ligloc=lighits->locs[l];
+			return 1;
+		}
+	}
+	return 0;
+}
+
+void get_arms(char*mipseq,char*ext,char*lig)
+{
+	char*nloc=strrchr(mipseq,'N');
+	char*cloc=strchr(mipseq,'C');
+	ext[0]='\0';
+	lig[0]='\0';
+	if(nloc!=NULL)
+		strncpy(ext,nloc+1,SLEN);
+	if(cloc!=NULL)
+	{
+		strncpy(lig,mipseq,cloc-mipseq);
+		lig[cloc-mipseq]='\0';
+	}
+	return;
+}
+
+void classify(struct mip*mipdata,long mnum,struct snvtable*snvdata,long nsnps,long chr,long offset)
+{
+	//SNVs are sorted by chromosome and coordinate, so start with the first SNV on the contig's chromosome at or after the MIP start (offset
+	//converts MIP coordinates to SNV table coordinates; in single-contig mode, all SNVs are on chr -1 and have contig coordinates)
+	long s,start=mipdata[mnum].start+offset,end=mipdata[mnum].end+offset;
 	int mgh=0,gm=0;
 	mipdata[mnum].type='N';
-	for(s=0;s<nsnps;s++)
+	for(s=find_snv(snvdata,nsnps,chr,start);(s<nsnps)&&(snvdata[s].chr==chr);s++)
 	{
-		if((snvdata[s].coord>=mipdata[mnum].start)&&(snvdata[s].coord<=mipdata[mnum].end))
+		if((snvdata[s].coord>=start)&&(snvdata[s].coord<=end))
 		{
 			if(snvdata[s].type=='M')
 				mgh=1;
@@ -376,7 +917,7 @@ void classify(struct mip*mipdata,long mnum,struct snvtable*snvdata,long nsnps)
 				return;
 			}
 		}
-		if(snvdata[s].coord>mipdata[mnum].end)
+		if(snvdata[s].coord>end)
 			break;
 	}
 	if((mgh==1)&&(gm==0))
@@ -388,13 +929,15 @@ void classify(struct mip*mipdata,long mnum,struct snvtable*snvdata,long nsnps)
 	return;
 }
 
-void annotate(struct mip*mipdata,long mnum,struct crtarg*targdata,long ntargs)
+void annotate(struct mip*mipdata,long mnum,struct crtarg*targdata,long ntargs,long chr,long offset)
 {
-	long t;
+	//CRISPR targets are sorted by chromosome and coordinate, so start with the first target on the contig's chromosome at or after the MIP start
+	//(offset converts MIP coordinates to CRISPR table coordinates, as in classify)
+	long t,start=mipdata[mnum].start+offset,end=mipdata[mnum].end+offset;
 	strncpy(mipdata[mnum].crispr,"none",SLEN);
-	for(t=0;t<ntargs;t++)
+	for(t=find_crtarg(targdata,ntargs,chr,start);(t<ntargs)&&(targdata[t].chr==chr);t++)
 	{
-		if((targdata[t].coord>=mipdata[mnum].start)&&(targdata[t].coord<=mipdata[mnum].end))
+		if((targdata[t].coord>=start)&&(targdata[t].coord<=end))
 		{
 			if(strncmp(mipdata[mnum].crispr,"none",SLEN)==0)
 				strncpy(mipdata[mnum].crispr,targdata[t].name,SLEN);
@@ -404,16 +947,17 @@ void annotate(struct mip*mipdata,long mnum,struct crtarg*targdata,long ntargs)
 				strncat(mipdata[mnum].crispr,targdata[t].name,SLEN);
 			}
 		}
-		if(targdata[t].coord>mipdata[mnum].end)
+		if(targdata[t].coord>end)
 			return;
 	}
 	return;
 }
 
-FILE*init_output(FILE*out,struct contig*c)
+FILE*init_output(char*name)
 {
-	char outname[SLEN+1];
-	sprintf(outname,"%s%s",c->name,".miptargets");
+	FILE*out;
+	char outname[strlen(name)+12];
+	sprintf(outname,"%s%s",name,".miptargets");
 	out=fopen(outname,"w");
 	fprintf(out,"Name\tSequence\tContig\tStart\tEnd\tType\tCRISPR\tStrand\tArm1Length\tTargetLength\n");
 	return out;
@@ -429,3 +973,179 @@ void print_data(FILE*out,struct mip*mipdata,long nummips)
 	return;
 }
 
+void batch_detail(char*argv[],int argc,struct mip*mips,long nmips)
+{
+	//read in contig coordinates
+	FILE*coordfile=fopen(*(argv+3),"r");
+	long ncoords=count_coords(coordfile);
+	struct contigcoords*coords=(struct contigcoords*)malloc(((ncoords>0)?ncoords:1)*sizeof(struct contigcoords));
+	get_coords(coordfile,coords);
+	fclose(coordfile);
+
+	//read in SNV and CRISPR target information from any optional input files, keeping chromosomal coordinates, and get the number of threads
+	struct chrlist chrs={NULL,0,0};
+	struct snvtable*snvs=NULL;
+	struct crtarg*crtargs=NULL;
+	long nsnvs=0,ncrispr=0;
+	int nthreads=sysconf(_SC_NPROCESSORS_ONLN),a;
+	FILE*infile;
+	for(a=4;a<argc;a++)
+	{
+		if(strstr(*(argv+a),"snvs")!=NULL)
+		{
+			infile=fopen(*(argv+a),"r");
+			nsnvs=count_snvs(infile);
+			snvs=(struct snvtable*)malloc(((nsnvs>0)?nsnvs:1)*sizeof(struct snvtable));
+			get_snvs(infile,snvs,1,&chrs);
+			fclose(infile);
+		}
+		else if(strstr(*(argv+a),"crispr")!=NULL)
+		{
+			infile=fopen(*(argv+a),"r");
+			ncrispr=count_crtargs(infile);
+			crtargs=(struct crtarg*)malloc(((ncrispr>0)?ncrispr:1)*sizeof(struct crtarg));
+			get_crtargs(infile,crtargs,1,&chrs);
+			fclose(infile);
+		}
+		else
+			nthreads=strtol(*(argv+a),NULL,10);
+	}
+
+	//index the multi-fasta file and compile the arms of all MIPs into one automaton shared by all threads
+	struct fasta fa;
+	open_fasta(*(argv+2),&fa);
+	struct armautomaton ac;
+	build_automaton(&ac,mips,nmips);
+
+	//annotate each contig (contigs are handed out to worker threads one at a time)
+	if(nthreads<1)
+		nthreads=1;
+	if(nthreads>fa.nrecs)
+		nthreads=(fa.nrecs>0)?fa.nrecs:1;
+	struct annotjob job={&fa,0,PTHREAD_MUTEX_INITIALIZER,&ac,mips,nmips,NULL,snvs,nsnvs,crtargs,ncrispr,coords,ncoords,&chrs,NULL,NULL};
+	job.anyfound=(int*)calloc(((nmips>0)?nmips:1),sizeof(int));
+	job.cmips=(struct mip**)calloc(((fa.nrecs>0)?fa.nrecs:1),sizeof(struct mip*));
+	job.ncmips=(long*)calloc(((fa.nrecs>0)?fa.nrecs:1),sizeof(long));
+	pthread_t*workers=(pthread_t*)malloc(nthreads*sizeof(pthread_t));
+	long t,r,m;
+	for(t=0;t<nthreads;t++)
+		pthread_create(&(workers[t]),NULL,annotate_contigs,&job);
+	for(t=0;t<nthreads;t++)
+		pthread_join(workers[t],NULL);
+
+	//report MIPs whose targets were not found in any contig
+	for(m=0;m<nmips;m++)
+	{
+		if(!(job.anyfound[m]))
+			printf(KRED "No target found for MIP %ld (%s) in any contig.\n" KNRM,m+1,mips[m].seq);
+	}
+
+	//print MIP data for all contigs, in fasta order, to a combined output file named after the fasta file, and for each contig to its own file
+	char*faname=strrchr(*(argv+2),'/');
+	faname=(faname!=NULL)?faname+1:*(argv+2);
+	char panel[strlen(faname)+1];
+	strcpy(panel,faname);
+	if(strrchr(panel,'.')!=NULL)
+		*strrchr(panel,'.')='\0';
+	FILE*combined=init_output(panel);
+	FILE*miptargets;
+	for(r=0;r<fa.nrecs;r++)
+	{
+		print_data(combined,job.cmips[r],job.ncmips[r]);
+		miptargets=init_output(fa.recs[r].name);
+		print_data(miptargets,job.cmips[r],job.ncmips[r]);
+		fclose(miptargets);
+		free(job.cmips[r]);
+	}
+	fclose(combined);
+
+	//clean up
+	free(workers);
+	free(job.anyfound);
+	free(job.cmips);
+	free(job.ncmips);
+	free_automaton(&ac);
+	close_fasta(&fa);
+	free(coords);
+	free(snvs);
+	free(crtargs);
+	free(chrs.names);
+	return;
+}
+
+void*annotate_contigs(void*arg)
+{
+	struct annotjob*job=(struct annotjob*)arg;
+	long nummips=job->nummips,r,m,n,c,chr,offset;
+	struct contig seq;
+	struct mip*cmips;
+
+	//allocate storage for this thread's copy of the MIP table
+	struct mip*work=(struct mip*)malloc(((nummips>0)?nummips:1)*sizeof(struct mip));
+	int*found=(int*)malloc(((nummips>0)?nummips:1)*sizeof(int));
+	memcpy(work,job->mips,nummips*sizeof(struct mip));
+	while(1)
+	{
+		pthread_mutex_lock(&(job->lock));
+		r=job->next++;
+		pthread_mutex_unlock(&(job->lock));
+		if(r>=job->fa->nrecs)
+			break;
+
+		//read in the contig sequence and locate the targets of all MIPs within it
+		get_seq(job->fa,r,&seq);
+		for(m=0;m<nummips;m++)
+			found[m]=0;
+		n=locate_targs(job->ac,work,nummips,&seq,found);
+
+		//keep the MIPs targeting this contig, numbered in input order
+		cmips=(struct mip*)malloc(((n>0)?n:1)*sizeof(struct mip));
+		n=0;
+		for(m=0;m<nummips;m++)
+		{
+			if(!(found[m]))
+				continue;
+			cmips[n]=work[m];
+			if(snprintf(cmips[n].name,SLEN+1,"%s_MIP_%04ld",seq.name,n+1)>SLEN)
+				printf(KRED "Name of MIP %ld in contig %s truncated to %d characters.\n" KNRM,n+1,seq.name,SLEN);
+			strncpy(cmips[n].chr,seq.name,SLEN);
+			n++;
+		}
+		pthread_mutex_lock(&(job->lock));
+		for(m=0;m<nummips;m++)
+		{
+			if(found[m])
+				job->anyfound[m]=1;
+		}
+		pthread_mutex_unlock(&(job->lock));
+
+		//find the chromosome the contig comes from and the offset converting contig coordinates to chromosomal coordinates (contigs missing
+		//from the .coords file, or on chromosomes without SNVs or CRISPR targets, get chromosome -1, which matches no entries)
+		chr=-1;
+		offset=0;
+		for(c=0;c<job->ncoords;c++)
+		{
+			if(strcmp(job->coords[c].contig,seq.name)==0)
+				break;
+		}
+		if(c<job->ncoords)
+		{
+			chr=chr_index(job->chrs,job->coords[c].chr,0);
+			offset=job->coords[c].start-1;
+		}
+
+		//annotate MIP targets with respect to SNVs and CRISPR targets, searching the shared sorted tables in place
+		for(m=0;m<n;m++)
+		{
+			classify(cmips,m,job->snps,job->numsnvs,chr,offset);
+			annotate(cmips,m,job->targs,job->numtargs,chr,offset);
+		}
+		job->cmips[r]=cmips;
+		job->ncmips[r]=n;
+		free(seq.bases);
+		free(seq.nmask);
+	}
+	free(work);
+	free(found);
+	return NULL;
+}
@@ -1,12 +1,12 @@
 //Xander Nuttle
 //dm_fastq_to_fastq_for_pear.c
-//Call: ./dm_fastq_to_fastq_for_pear reads1.fastq.gz reads2.fastq.gz reads3.fastq.gz reads4.fastq.gz (int)trimmed_read_length (int)molecular_tag_length (long)max_num_reads_per_output_file barcodekey_file
+//Call: ./dm_fastq_to_fastq_for_pear reads1.fastq.gz reads2.fastq.gz reads3.fastq.gz reads4.fastq.gz (int)trimmed_read_length (int)molecular_tag_length (long)max_num_reads_per_output_file barcodekey_file <miptargets_file|none> <(int)num_threads>
 //
-//Takes four demultiplexed gzipped fastq files together containing data for a single sample from a sequencing run (a file with all first reads,
-//a file with all index1 reads, a file with all index2 reads, and a file with all second reads) and generates gzipped fastq files as output.
-//Only adds reads having a barcode sequence combination perfectly matching the sample's known barcode sequence combination to the output fastq files.
-//Generates 1 or more sets of gzipped fastq files for the sample. Assumes MIPs have been molecularly tagged at one location just internal to the
-//extension arm to allow for counting of individual capture events.
+//Takes four gzipped fastq files from a sequencing run (a file with all first reads, a file with all index1 reads, a file with all index2 reads,
+//and a file with all second reads) and generates gzipped fastq files as output. The input files may hold demultiplexed data for a single sample or
+//undemultiplexed data for every sample listed in the barcodekey file. Only adds reads having a barcode sequence combination perfectly matching a
+//listed sample's known barcode sequence combination to that sample's output fastq files. Generates 1 or more sets of gzipped fastq files for each
+//sample. Assumes MIPs have been molecularly tagged at one location just internal to the extension arm to allow for counting of individual capture events.
 //
 //This program converts demultiplexed gzipped fastq files (containing data for a single sample from a sequencing run) into smaller gzipped fastq files, which serve
 //as input to PEAR, a program to merge overlapping reads. There are four demultiplexed gzipped fastq files per sample - the first file contains the first
@@ -29,38 +29,228 @@
 //
 //This program deals with a space in sequence names and accomodates dual-index barcoding. It prints reads 1 and reads 2 to separate output files, thus preparing reads
 //for merging with the program PEAR (https://www.ncbi.nlm.nih.gov/pmc/articles/PMC3933873/).
+//
+//The barcodekey file may list a single sample (as generated by set_up_demultiplexed_fastqs.sh) or every sample from a sequencing run (as generated by
+//set_up_undemultiplexed_fastqs.sh, or the experiment-wide barcodekey file listing sample names in column 1, index barcodes in column 2, and index2
+//barcodes in column 3). When more than one sample is listed, the four input files should contain undemultiplexed data for the whole run; all samples'
+//barcodes are loaded into a hash table keyed on the concatenated index1+index2 sequence, and each read pair is routed to the output files of its sample
+//in a single pass over the input data. Each sample's output files are opened when its first read pair is kept (samples without any kept read pairs get
+//one set of empty output files at the end), and the limit on open files is raised as far as the system allows, since every sample present in the run
+//keeps its current output files open.
+//
+//The optional num_threads argument sets the number of worker threads used to compress output files and to decompress BGZF-formatted input files
+//(default: the number of online processors). Each input file is also decompressed by its own reader thread, so the program uses several cores even when the inputs are ordinary
+//gzipped fastq files. Output files are written as series of independently compressed gzip members and decompress to exactly the same fastq data.
+//
+//If a miptargets file is given as the first optional argument ("none" skips merging, e.g., to set only the number of threads), read pairs are merged by this program rather than by PEAR, and merged reads are printed to a
+//single gzipped fastq file per set (named *_FS1_M*.fastq.gz, as for PEAR output). Each read pair's insert length is first sought among the lengths of the
+//sequences captured by the listed MIPs (End-Start+1), scoring the overlap 16 bases at a time with SSE2 instructions where available; read pairs overlapping
+//by none of those lengths (e.g., read pairs from MIPs capturing insertions or deletions) are scored at every possible overlap. Where overlapping bases
+//disagree, the base with the higher quality score is kept. Read pairs that cannot be merged are not printed.
 
 #include<stdio.h>
 #include<zlib.h>
 #include<string.h>
 #include<stdlib.h>
+#include<pthread.h>
+#include<unistd.h>
+#include<sys/resource.h>
+#ifdef __SSE2__
+#include<emmintrin.h>
+#endif
 #define LEN 101 //maximum length of sample names and barcode sequences + 1
+#define BLEN 131072 //number of uncompressed bytes in each independently compressed block of an output file
+#define RLEN 1048576 //maximum number of uncompressed bytes in each chunk passed from an input reader thread to the main thread
+#define QLEN 8 //maximum number of chunks queued ahead of the main thread for each input file
+#define JINFLATE 0 //job types for worker threads and the writer thread
+#define JDEFLATE 1
+#define JCLOSE 2
+#define MINOVL 10 //minimum number of overlapping bases required to merge a read pair
+#define MINMERGE 50 //minimum length of a merged read
+#define MAXMMFRAC 0.1 //maximum fraction of mismatched bases in the overlap of a merged read pair
+#define MMPEN 3 //score penalty for each mismatched base in the overlap of a read pair (each matched base scores 1)
+
+//set up structure to store a block of data to be compressed or decompressed by a worker thread
+struct job
+{
+	int type;
+	unsigned char*in;
+	long inlen;
+	unsigned char*out;
+	long outlen;
+	long outsize;
+	int done;
+	struct gzout*dest;
+	struct job*next; //next job waiting for a worker thread
+	struct job*onext; //next job in file order (for the main thread or the writer thread)
+};
+
+//set up structure to store the worker thread pool and the queue of compressed blocks waiting to be written
+struct pipeline
+{
+	pthread_mutex_t lock;
+	pthread_cond_t work;
+	pthread_cond_t done;
+	pthread_cond_t ready;
+	pthread_cond_t space;
+	struct job*head;
+	struct job*tail;
+	struct job*whead;
+	struct job*wtail;
+	long wqueued;
+	long wmax;
+	int shutdown;
+	int nthreads;
+	pthread_t*workers;
+	pthread_t writer;
+};
+
+//set up structure to store an input file decompressed by a reader thread
+struct gzin
+{
+	struct pipeline*pipe;
+	gzFile gz;
+	FILE*raw;
+	int bgzf;
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t ready;
+	pthread_cond_t space;
+	struct job*head;
+	struct job*tail;
+	int queued;
+	int eof;
+	int stop;
+	struct job*cur;
+	long pos;
+};
+
+//set up structure to store an output file compressed in blocks
+struct gzout
+{
+	struct pipeline*pipe;
+	FILE*file;
+	unsigned char*buf;
+	long len;
+	long nblocks;
+};
+
+//set up structure to store sample information, including the output files to which the sample's read pairs are written
+struct sample
+{
+	char name[LEN];
+	char barcode[LEN];
+	struct gzout*outfiles[2];
+	int output_file_num;
+	long reads_output;
+};
+
+//set up structure to store the four fastq lines of each read of a read pair as they will be printed
+struct readpair
+{
+	char lines[2][4][501];
+};
+
+long count_samples(FILE*bkey);
+long get_samples(FILE*bkey,struct sample*samps);
+long*build_index(struct sample*samps,long nsamps,long*tsize);
+unsigned long hash_barcode(char*bc);
+long findsample(char*bc,struct sample*samps,long*index,long tsize);
+void open_outputs(struct sample*samp,struct pipeline*pipe,int merge);
+void close_outputs(struct sample*samp);
+long*get_inserts(FILE*mtargs,long*ninserts);
+void print_pair(struct readpair*rp,struct gzout**outs);
+int merge_pair(struct readpair*rp,long*inserts,long ninserts,struct gzout*out);
+long find_insert(char*seq1,long len1,char*seq2,long len2,long*inserts,long ninserts);
+long score_overlap(char*seq1,long len1,char*seq2,long len2,long insert);
+long count_mismatches(char*a,char*b,long n,long maxmm);
+void revcomp(char*seq,char*rc,long len);
+int goodtag(char*tag);
+struct pipeline*init_pipeline(int nthreads);
+void close_pipeline(struct pipeline*pipe);
+void submit_job(struct pipeline*pipe,struct job*j);
+void wait_job(struct pipeline*pipe,struct job*j);
+void free_job(struct job*j);
+void*run_worker(void*arg);
+void*run_writer(void*arg);
+void deflate_block(struct job*j);
+void inflate_blocks(struct job*j);
+struct gzin*pz_open_in(char*name,struct pipeline*pipe);
+void*run_reader(void*arg);
+int next_chunk(struct gzin*in);
+char*pz_gets(struct gzin*in,char*buf,int len);
+void pz_close_in(struct gzin*in);
+struct gzout*pz_open_out(char*name,struct pipeline*pipe);
+void pz_puts(struct gzout*out,char*str);
+void pz_flush(struct gzout*out);
+void pz_close_out(struct gzout*out);
+void queue_write(struct pipeline*pipe,struct job*j);
 
 int main(int argc,char*argv[])
 {
-	//read in sample name and barcode from barcodekey file
-	char sample[LEN],barcode[LEN];
+	//read in sample names and barcodes from barcodekey file and index barcodes for fast lookup
 	FILE*barcodekey=fopen(*(argv+8),"r");
-	fscanf(barcodekey,"%s %s",sample,barcode);	
-	int bc_length=strlen(barcode);
+	if(barcodekey==NULL)
+	{
+		printf("Unable to open barcodekey file %s.\n",*(argv+8));
+		return 1;
+	}
+	long nsamples=count_samples(barcodekey);
+	struct sample*samples;
+	samples=(struct sample*)malloc(((nsamples>0)?nsamples:1)*sizeof(struct sample));
+	nsamples=get_samples(barcodekey,samples);
 	fclose(barcodekey);
-	
+	if(nsamples==0)
+	{
+		printf("No samples with barcodes listed in barcodekey file %s.\n",*(argv+8));
+		free(samples);
+		return 1;
+	}
+	int bc_length=strlen(samples[0].barcode);
+	long tablesize;
+	long*bcindex=build_index(samples,nsamples,&tablesize);
+
+	//read in optional arguments: a miptargets file (if read pairs are to be merged, otherwise "none") and the number of worker threads
+	int merge=0;
+	long ninserts=0;
+	long*inserts=NULL;
+	FILE*miptargets;
+	if((argc>9)&&(strcmp(*(argv+9),"none")!=0))
+	{
+		miptargets=fopen(*(argv+9),"r");
+		inserts=get_inserts(miptargets,&ninserts);
+		fclose(miptargets);
+		merge=1;
+	}
+	int nthreads=(argc>10)?strtol(*(argv+10),NULL,10):sysconf(_SC_NPROCESSORS_ONLN);
+
+	//start worker threads for compression and decompression
+	struct pipeline*pipeline=init_pipeline(nthreads);
+
 	//setup input files
-	gzFile*in1,*in2,*in3,*in4;
+	struct gzin*in1,*in2,*in3,*in4;
 
-	//setup output files
-	char outname1[LEN],outname2[LEN];
-  gzFile*outfiles[2];
-	sprintf(outname1,"%s_FS1_F1.fastq.gz\0",sample);
-	sprintf(outname2,"%s_FS1_R1.fastq.gz\0",sample);
-	outfiles[0]=gzopen(outname1,"w");
-	outfiles[1]=gzopen(outname2,"w");
+	//setup output files (each sample's files are opened when its first read pair is kept, and each sample present in the run keeps its current
+	//files open, so raise the limit on open files as far as allowed)
+	long s;
+	for(s=0;s<nsamples;s++)
+	{
+		samples[s].outfiles[0]=NULL;
+		samples[s].outfiles[1]=NULL;
+		samples[s].output_file_num=1;
+		samples[s].reads_output=0;
+	}
+	struct rlimit fdlimit;
+	if(getrlimit(RLIMIT_NOFILE,&fdlimit)==0)
+	{
+		fdlimit.rlim_cur=fdlimit.rlim_max;
+		setrlimit(RLIMIT_NOFILE,&fdlimit);
+	}
 
 	//setup variables: specify read length, index read length, and desired number of sequence reads per fastq file
 	long trimmed_read_length; //(76 bp is the minimal value to cover all targeted bases (112 bp) + both hybridization arms (20 bp each)), 142 bp recommended for sequence analysis
 	long tag_length;
   long reads_per_fastq=strtol(*(argv+7),NULL,10); //250,000 recommended
-	int output_file_num=1;
 
 	//read in trimmed read length value from the command line
 	trimmed_read_length=strtol(*(argv+5),NULL,10);
@@ -69,59 +259,46 @@ int main(int argc,char*argv[])
 	tag_length=strtol(*(argv+6),NULL,10);
 
 	//setup variables
-	in1=gzopen(*(argv+1),"r");
-  in2=gzopen(*(argv+2),"r");
-  in3=gzopen(*(argv+3),"r");
-	in4=gzopen(*(argv+4),"r");
+	in1=pz_open_in(*(argv+1),pipeline);
+  in2=pz_open_in(*(argv+2),pipeline);
+  in3=pz_open_in(*(argv+3),pipeline);
+	in4=pz_open_in(*(argv+4),pipeline);
 	char line[501],line2[501];
   line[500]='\0';
 	line2[500]='\0';
-	long reads_output=0;
-	int i,k;
+	int i,keep;
 	char index_sequence[bc_length+1];
 	index_sequence[bc_length]='\0';
 	char tag_sequence[tag_length+1];
 	tag_sequence[tag_length]='\0';
+	struct readpair pair;
 
 	//read in large gzipped fastq files line by line, trim sequences, and print output
-	while(gzgets(in2,line,500))
+	while(pz_gets(in2,line,500))
 	{
-		if(reads_output>=reads_per_fastq)
-		{
-			gzclose(outfiles[0]);
-			gzclose(outfiles[1]);
-			output_file_num++;
-			sprintf(outname1,"%s_FS1_F%d.fastq.gz\0",sample,output_file_num);
-			sprintf(outname2,"%s_FS1_R%d.fastq.gz\0",sample,output_file_num);
-			outfiles[0]=gzopen(outname1,"w");
-			outfiles[1]=gzopen(outname2,"w");
-			reads_output=0;
-		}
-		
 		//process data for index1 sequence
-		gzgets(in2,line,500);
+		pz_gets(in2,line,500);
 		strncpy(index_sequence,line,bc_length/2); //index quality will not later explicity be taken into account, but it will in the sense that only index sequences with perfect matches to known barcodes will be used
 		index_sequence[bc_length/2]='\0';
-		gzgets(in2,line,500);
-		gzgets(in2,line,500);		
+		pz_gets(in2,line,500);
+		pz_gets(in2,line,500);
 
 		//process data for index2 sequence
-		gzgets(in3,line,500);
-		gzgets(in3,line,500);
+		pz_gets(in3,line,500);
+		pz_gets(in3,line,500);
 		strncat(index_sequence,line,bc_length/2); //index quality will not later explicity be taken into account, but it will in the sense that only index sequences with perfect matches to known barcodes will be used
-		gzgets(in3,line,500);
-		gzgets(in3,line,500);
+		pz_gets(in3,line,500);
+		pz_gets(in3,line,500);
 
 		//ensure barcode sequence perfectly matches a known barcode reverse complement sequence, and if so, identify which individual the read pair corresponds to
-		int indiv=-1;
-		if(strncmp(index_sequence,barcode,bc_length)==0)
-			indiv=1;
+		long indiv=findsample(index_sequence,samples,bcindex,tablesize);
 
 		//process data for second sequence
-    gzgets(in4,line,500);
-    gzgets(in4,line2,500);
+    pz_gets(in4,line,500);
+    pz_gets(in4,line2,500);
 		strncpy(tag_sequence,line2,tag_length);
-		if((indiv!=-1)&&(!(strchr(tag_sequence,'N')))&&(strstr(tag_sequence,"AAAAA")==NULL)&&(strstr(tag_sequence,"CCCCC")==NULL)&&(strstr(tag_sequence,"GGGGG")==NULL)&&(strstr(tag_sequence,"TTTTT")==NULL))
+		keep=((indiv!=-1)&&(goodtag(tag_sequence)));
+		if(keep)
     {
     	line[strlen(line)-5]='\0'; //remove the newline from the string "line", as well as the '#0/3'
 			if(strchr(line,' ')!=NULL)
@@ -131,29 +308,28 @@ int main(int argc,char*argv[])
 			strncat(line,"/2 MI:Z:$",9);
 			strncat(line,tag_sequence,tag_length); //add molecular tag information to sequence name
 			strncat(line,"\n",1);
-			gzputs(outfiles[1],line);
+			strcpy(pair.lines[1][0],line);
 			strncpy(line,line2+tag_length,trimmed_read_length);
 			line[trimmed_read_length]='\n';
       line[trimmed_read_length+1]='\0';
-      gzputs(outfiles[1],line);
+      strcpy(pair.lines[1][1],line);
     }
-		gzgets(in4,line,500);
-    gzgets(in4,line2,500);
-		if((indiv!=-1)&&(!(strchr(tag_sequence,'N')))&&(strstr(tag_sequence,"AAAAA")==NULL)&&(strstr(tag_sequence,"CCCCC")==NULL)&&(strstr(tag_sequence,"GGGGG")==NULL)&&(strstr(tag_sequence,"TTTTT")==NULL))
+		pz_gets(in4,line,500);
+    pz_gets(in4,line2,500);
+		if(keep)
     {
-      gzputs(outfiles[1],line);
+      strcpy(pair.lines[1][2],line);
       strncpy(line,line2+tag_length,trimmed_read_length);
       line[trimmed_read_length]='\n';
       line[trimmed_read_length+1]='\0';
-      gzputs(outfiles[1],line);
-			reads_output++;
+      strcpy(pair.lines[1][3],line);
     }
 
 		//process data for first sequence
 		for(i=0;i<4;i++)
     {
-      gzgets(in1,line,500);
-      if((indiv!=-1)&&(!(strchr(tag_sequence,'N')))&&(strstr(tag_sequence,"AAAAA")==NULL)&&(strstr(tag_sequence,"CCCCC")==NULL)&&(strstr(tag_sequence,"GGGGG")==NULL)&&(strstr(tag_sequence,"TTTTT")==NULL))
+      pz_gets(in1,line,500);
+      if(keep)
       {
         if(i==0)
 				{
@@ -171,18 +347,824 @@ int main(int argc,char*argv[])
         	line[trimmed_read_length]='\n';
         	line[trimmed_read_length+1]='\0';
       	}
-				gzputs(outfiles[0],line);
+				strcpy(pair.lines[0][i],line);
       }
     }
+
+		//print the read pair, or the merged read if read pairs are being merged
+		if(keep)
+		{
+			//open the individual's first set of output files, or start a new set once the current set is full
+			if(samples[indiv].outfiles[0]==NULL)
+				open_outputs(&(samples[indiv]),pipeline,merge);
+			else if(samples[indiv].reads_output>=reads_per_fastq)
+			{
+				close_outputs(&(samples[indiv]));
+				samples[indiv].output_file_num++;
+				samples[indiv].reads_output=0;
+				open_outputs(&(samples[indiv]),pipeline,merge);
+			}
+			if(!merge)
+			{
+				print_pair(&pair,samples[indiv].outfiles);
+				samples[indiv].reads_output++;
+			}
+			else if(merge_pair(&pair,inserts,ninserts,samples[indiv].outfiles[0]))
+				samples[indiv].reads_output++;
+		}
 	}
 
 	//clean up and exit
-	gzclose(in1);
-  gzclose(in2);
-  gzclose(in3);
-  gzclose(in4);
-	gzclose(outfiles[0]);
-	gzclose(outfiles[1]);
+	pz_close_in(in1);
+  pz_close_in(in2);
+  pz_close_in(in3);
+  pz_close_in(in4);
+	for(s=0;s<nsamples;s++)
+	{
+		if(samples[s].outfiles[0]==NULL) //samples without any kept read pairs get one set of empty output files
+			open_outputs(&(samples[s]),pipeline,merge);
+		close_outputs(&(samples[s]));
+	}
+	close_pipeline(pipeline);
+	free(inserts);
+	free(bcindex);
+	free(samples);
   return 0;
 }
 
+long count_samples(FILE*bkey)
+{
+	long numsamps=0;
+	char lyne[4*LEN];
+	fpos_t pos;
+	fgetpos(bkey,&pos);
+	while(fgets(lyne,4*LEN,bkey)!=NULL)
+	{
+		if(strspn(lyne," \t\r\n")<strlen(lyne))
+			numsamps++;
+	}
+	fsetpos(bkey,&pos);
+	return numsamps;
+}
+
+long get_samples(FILE*bkey,struct sample*samps)
+{
+	long s=0;
+	char lyne[4*LEN],bc2[LEN];
+	int nfields;
+	while(fgets(lyne,4*LEN,bkey)!=NULL)
+	{
+		nfields=sscanf(lyne,"%s %s %s",samps[s].name,samps[s].barcode,bc2);
+		if(nfields<2)
+			continue;
+		if(nfields==3) //experiment-wide barcodekey files list index1 and index2 barcodes in separate columns
+			strncat(samps[s].barcode,bc2,LEN-1-strlen(samps[s].barcode));
+		s++;
+	}
+	return s;
+}
+
+long*build_index(struct sample*samps,long nsamps,long*tsize)
+{
+	long s,slot;
+	long*index;
+	*tsize=1;
+	while((*tsize)<2*nsamps) //keep the table at most half full so probe sequences stay short
+		(*tsize)*=2;
+	index=(long*)malloc((*tsize)*sizeof(long));
+	for(slot=0;slot<(*tsize);slot++)
+		index[slot]=-1;
+	for(s=0;s<nsamps;s++)
+	{
+		if(findsample(samps[s].barcode,samps,index,*tsize)!=-1) //if two samples share a barcode combination, reads are assigned to the first one listed
+			continue;
+		slot=hash_barcode(samps[s].barcode)&((*tsize)-1);
+		while(index[slot]!=-1)
+			slot=(slot+1)&((*tsize)-1);
+		index[slot]=s;
+	}
+	return index;
+}
+
+unsigned long hash_barcode(char*bc)
+{
+	unsigned long h=14695981039346656037UL; //FNV-1a hash
+	while(*bc!='\0')
+	{
+		h^=(unsigned char)(*bc);
+		h*=1099511628211UL;
+		bc++;
+	}
+	return h;
+}
+
+long findsample(char*bc,struct sample*samps,long*index,long tsize)
+{
+	long slot=hash_barcode(bc)&(tsize-1);
+	while(index[slot]!=-1)
+	{
+		if(strncmp(samps[index[slot]].barcode,bc,LEN)==0)
+			return index[slot];
+		slot=(slot+1)&(tsize-1);
+	}
+	return -1;
+}
+
+void open_outputs(struct sample*samp,struct pipeline*pipe,int merge)
+{
+	char outname1[LEN+30],outname2[LEN+30];
+	if(merge) //merged reads are printed to a single output file, in place of the file of merged reads previously generated by PEAR
+	{
+		sprintf(outname1,"%s_FS1_M%d.fastq.gz",samp->name,samp->output_file_num);
+		samp->outfiles[0]=pz_open_out(outname1,pipe);
+		samp->outfiles[1]=NULL;
+		return;
+	}
+	sprintf(outname1,"%s_FS1_F%d.fastq.gz",samp->name,samp->output_file_num);
+	sprintf(outname2,"%s_FS1_R%d.fastq.gz",samp->name,samp->output_file_num);
+	samp->outfiles[0]=pz_open_out(outname1,pipe);
+	samp->outfiles[1]=pz_open_out(outname2,pipe);
+	return;
+}
+
+void close_outputs(struct sample*samp)
+{
+	pz_close_out(samp->outfiles[0]);
+	if(samp->outfiles[1]!=NULL)
+		pz_close_out(samp->outfiles[1]);
+	return;
+}
+
+long*get_inserts(FILE*mtargs,long*ninserts)
+{
+	char lyne[1001];
+	long start,end,insert,k,numlines=0;
+	long*inserts;
+	fgets(lyne,1001,mtargs); //skip header line
+	while(fgets(lyne,1001,mtargs)!=NULL)
+		numlines++;
+	rewind(mtargs);
+	fgets(lyne,1001,mtargs);
+	inserts=(long*)malloc((numlines+1)*sizeof(long));
+	*ninserts=0;
+	while(fgets(lyne,1001,mtargs)!=NULL)
+	{
+		if(sscanf(lyne,"%*s %*s %*s %ld %ld",&start,&end)!=2)
+			continue;
+		insert=end-start+1; //length of the captured sequence, including both hybridization arms
+		for(k=0;k<(*ninserts);k++)
+		{
+			if(inserts[k]==insert)
+				break;
+		}
+		if(k==(*ninserts))
+		{
+			inserts[k]=insert;
+			(*ninserts)++;
+		}
+	}
+	return inserts;
+}
+
+void print_pair(struct readpair*rp,struct gzout**outs)
+{
+	int r,i;
+	for(r=1;r>=0;r--)
+	{
+		for(i=0;i<4;i++)
+			pz_puts(outs[r],rp->lines[r][i]);
+	}
+	return;
+}
+
+int merge_pair(struct readpair*rp,long*inserts,long ninserts,struct gzout*out)
+{
+	char seq2[501],qual2[501],mseq[1002],mqual[1002];
+	char*seq1=rp->lines[0][1];
+	char*qual1=rp->lines[0][3];
+	long len1=strcspn(seq1,"\n");
+	long len2=strcspn(rp->lines[1][1],"\n");
+	long insert,p,d;
+	char b1,b2,q1,q2;
+	int in1,in2;
+
+	//reverse complement the second read so both reads are in the orientation of the first read
+	revcomp(rp->lines[1][1],seq2,len2);
+	for(p=0;p<len2;p++)
+		qual2[p]=rp->lines[1][3][len2-1-p];
+
+	//find the length of the sequenced insert, and do not print read pairs which cannot be merged (as was done for PEAR output)
+	insert=find_insert(seq1,len1,seq2,len2,inserts,ninserts);
+	if(insert==-1)
+		return 0;
+
+	//build the merged read; where reads overlap and disagree, keep the higher-quality base with its quality reduced by that of the other base
+	d=insert-len2; //position in the merged read of the first base of the reverse-complemented second read
+	for(p=0;p<insert;p++)
+	{
+		in1=(p<len1);
+		in2=(p>=d);
+		if(in1&&in2)
+		{
+			b1=seq1[p];
+			q1=qual1[p];
+			b2=seq2[p-d];
+			q2=qual2[p-d];
+			if(b2=='N')
+			{
+				mseq[p]=b1;
+				mqual[p]=q1;
+			}
+			else if(b1=='N')
+			{
+				mseq[p]=b2;
+				mqual[p]=q2;
+			}
+			else if(b1==b2)
+			{
+				mseq[p]=b1;
+				mqual[p]=(q1>q2)?q1:q2;
+			}
+			else if(q1>=q2)
+			{
+				mseq[p]=b1;
+				mqual[p]=q1-q2+'!';
+			}
+			else
+			{
+				mseq[p]=b2;
+				mqual[p]=q2-q1+'!';
+			}
+		}
+		else if(in1)
+		{
+			mseq[p]=seq1[p];
+			mqual[p]=qual1[p];
+		}
+		else
+		{
+			mseq[p]=seq2[p-d];
+			mqual[p]=qual2[p-d];
+		}
+	}
+	mseq[insert]='\n';
+	mseq[insert+1]='\0';
+	mqual[insert]='\n';
+	mqual[insert+1]='\0';
+
+	//print the merged read under the name of the first read
+	pz_puts(out,rp->lines[0][0]);
+	pz_puts(out,mseq);
+	pz_puts(out,"+\n");
+	pz_puts(out,mqual);
+	return 1;
+}
+
+long find_insert(char*seq1,long len1,char*seq2,long len2,long*inserts,long ninserts)
+{
+	long k,insert,score,best=-1,bestscore=-1;
+
+	//first try the insert lengths of the MIPs, as nearly all read pairs will overlap by one of these few amounts
+	for(k=0;k<ninserts;k++)
+	{
+		score=score_overlap(seq1,len1,seq2,len2,inserts[k]);
+		if(score>bestscore)
+		{
+			best=inserts[k];
+			bestscore=score;
+		}
+	}
+	if(best!=-1)
+		return best;
+
+	//otherwise (e.g., for read pairs from MIPs capturing an insertion or deletion), try every possible insert length, favoring longer ones in the case of a tie
+	for(insert=len1+len2-MINOVL;insert>=MINMERGE;insert--)
+	{
+		score=score_overlap(seq1,len1,seq2,len2,insert);
+		if(score>bestscore)
+		{
+			best=insert;
+			bestscore=score;
+		}
+	}
+	return best;
+}
+
+long score_overlap(char*seq1,long len1,char*seq2,long len2,long insert)
+{
+	long d=insert-len2;
+	long start=(d>0)?d:0;
+	long end=(insert<len1)?insert:len1;
+	long n=end-start;
+	long maxmm,mm;
+	if((insert<MINMERGE)||(n<MINOVL))
+		return -1;
+	maxmm=(long)(n*MAXMMFRAC);
+	mm=count_mismatches(seq1+start,seq2+start-d,n,maxmm);
+	if(mm>maxmm)
+		return -1;
+	return (n-mm)-MMPEN*mm;
+}
+
+long count_mismatches(char*a,char*b,long n,long maxmm)
+{
+	long i=0,mm=0;
+#ifdef __SSE2__
+	//compare 16 bases at a time, treating bases where either read has an N as matches; stop early once too many mismatches are found
+	__m128i nn=_mm_set1_epi8('N');
+	__m128i va,vb,same;
+	for(;i+16<=n;i+=16)
+	{
+		va=_mm_loadu_si128((__m128i*)(a+i));
+		vb=_mm_loadu_si128((__m128i*)(b+i));
+		same=_mm_or_si128(_mm_cmpeq_epi8(va,vb),_mm_or_si128(_mm_cmpeq_epi8(va,nn),_mm_cmpeq_epi8(vb,nn)));
+		mm+=16-__builtin_popcount(_mm_movemask_epi8(same));
+		if(mm>maxmm)
+			return mm;
+	}
+#endif
+	for(;i<n;i++)
+	{
+		if((a[i]!=b[i])&&(a[i]!='N')&&(b[i]!='N'))
+			mm++;
+	}
+	return mm;
+}
+
+void revcomp(char*seq,char*rc,long len)
+{
+	long p;
+	for(p=0;p<len;p++)
+	{
+		switch(seq[len-1-p])
+		{
+			case 'A': rc[p]='T'; break;
+			case 'C': rc[p]='G'; break;
+			case 'G': rc[p]='C'; break;
+			case 'T': rc[p]='A'; break;
+			default: rc[p]='N';
+		}
+	}
+	return;
+}
+
+int goodtag(char*tag)
+{
+	return ((!(strchr(tag,'N')))&&(strstr(tag,"AAAAA")==NULL)&&(strstr(tag,"CCCCC")==NULL)&&(strstr(tag,"GGGGG")==NULL)&&(strstr(tag,"TTTTT")==NULL));
+}
+
+//pipeline functions below
+//
+//Each input file is decompressed by its own reader thread, which passes large chunks of uncompressed data to the main thread through a short queue.
+//Inputs in BGZF format (e.g., compressed with bgzip) consist of independently compressed blocks, so the reader thread instead hands groups of blocks
+//to the worker threads for parallel decompression. Output files are written in blocks of BLEN uncompressed bytes; each block is compressed by a
+//worker thread into its own gzip member and written to disk in order by a single writer thread. A file of concatenated gzip members decompresses
+//to the same data as a file written with a single stream, so the reads passed to PEAR are unchanged.
+struct pipeline*init_pipeline(int nthreads)
+{
+	struct pipeline*pipe=(struct pipeline*)malloc(sizeof(struct pipeline));
+	int t;
+	pthread_mutex_init(&(pipe->lock),NULL);
+	pthread_cond_init(&(pipe->work),NULL);
+	pthread_cond_init(&(pipe->done),NULL);
+	pthread_cond_init(&(pipe->ready),NULL);
+	pthread_cond_init(&(pipe->space),NULL);
+	pipe->head=NULL;
+	pipe->tail=NULL;
+	pipe->whead=NULL;
+	pipe->wtail=NULL;
+	pipe->wqueued=0;
+	pipe->wmax=4*nthreads+4;
+	pipe->shutdown=0;
+	pipe->nthreads=(nthreads>0)?nthreads:1;
+	pipe->workers=(pthread_t*)malloc(pipe->nthreads*sizeof(pthread_t));
+	for(t=0;t<pipe->nthreads;t++)
+		pthread_create(&(pipe->workers[t]),NULL,run_worker,pipe);
+	pthread_create(&(pipe->writer),NULL,run_writer,pipe);
+	return pipe;
+}
+
+void close_pipeline(struct pipeline*pipe)
+{
+	int t;
+	pthread_mutex_lock(&(pipe->lock));
+	pipe->shutdown=1;
+	pthread_cond_broadcast(&(pipe->work));
+	pthread_cond_broadcast(&(pipe->ready));
+	pthread_mutex_unlock(&(pipe->lock));
+	pthread_join(pipe->writer,NULL); //writer exits once every queued block has been written
+	for(t=0;t<pipe->nthreads;t++)
+		pthread_join(pipe->workers[t],NULL);
+	free(pipe->workers);
+	free(pipe);
+	return;
+}
+
+void submit_job(struct pipeline*pipe,struct job*j)
+{
+	pthread_mutex_lock(&(pipe->lock));
+	j->next=NULL;
+	if(pipe->tail==NULL)
+		pipe->head=j;
+	else
+		pipe->tail->next=j;
+	pipe->tail=j;
+	pthread_cond_signal(&(pipe->work));
+	pthread_mutex_unlock(&(pipe->lock));
+	return;
+}
+
+void wait_job(struct pipeline*pipe,struct job*j)
+{
+	pthread_mutex_lock(&(pipe->lock));
+	while(!(j->done))
+		pthread_cond_wait(&(pipe->done),&(pipe->lock));
+	pthread_mutex_unlock(&(pipe->lock));
+	return;
+}
+
+void free_job(struct job*j)
+{
+	free(j->in);
+	free(j->out);
+	free(j);
+	return;
+}
+
+void*run_worker(void*arg)
+{
+	struct pipeline*pipe=(struct pipeline*)arg;
+	struct job*j;
+	while(1)
+	{
+		pthread_mutex_lock(&(pipe->lock));
+		while((pipe->head==NULL)&&(!(pipe->shutdown)))
+			pthread_cond_wait(&(pipe->work),&(pipe->lock));
+		if(pipe->head==NULL)
+		{
+			pthread_mutex_unlock(&(pipe->lock));
+			break;
+		}
+		j=pipe->head;
+		pipe->head=j->next;
+		if(pipe->head==NULL)
+			pipe->tail=NULL;
+		pthread_mutex_unlock(&(pipe->lock));
+		if(j->type==JDEFLATE)
+			deflate_block(j);
+		else
+			inflate_blocks(j);
+		pthread_mutex_lock(&(pipe->lock));
+		j->done=1;
+		pthread_cond_broadcast(&(pipe->done));
+		pthread_mutex_unlock(&(pipe->lock));
+	}
+	return NULL;
+}
+
+void*run_writer(void*arg)
+{
+	struct pipeline*pipe=(struct pipeline*)arg;
+	struct job*j;
+	while(1)
+	{
+		pthread_mutex_lock(&(pipe->lock));
+		while((pipe->whead==NULL)&&(!(pipe->shutdown)))
+			pthread_cond_wait(&(pipe->ready),&(pipe->lock));
+		if(pipe->whead==NULL)
+		{
+			pthread_mutex_unlock(&(pipe->lock));
+			break;
+		}
+		j=pipe->whead;
+		pipe->whead=j->onext;
+		if(pipe->whead==NULL)
+			pipe->wtail=NULL;
+		while(!(j->done))
+			pthread_cond_wait(&(pipe->done),&(pipe->lock));
+		pipe->wqueued--;
+		pthread_cond_broadcast(&(pipe->space));
+		pthread_mutex_unlock(&(pipe->lock));
+		if(j->type==JCLOSE)
+		{
+			fclose(j->dest->file);
+			free(j->dest->buf);
+			free(j->dest);
+		}
+		else
+			fwrite(j->out,1,j->outlen,j->dest->file);
+		free_job(j);
+	}
+	return NULL;
+}
+
+void deflate_block(struct job*j)
+{
+	z_stream strm;
+	strm.zalloc=Z_NULL;
+	strm.zfree=Z_NULL;
+	strm.opaque=Z_NULL;
+	deflateInit2(&strm,Z_DEFAULT_COMPRESSION,Z_DEFLATED,31,8,Z_DEFAULT_STRATEGY); //windowBits of 31 writes a gzip header and trailer
+	j->outsize=deflateBound(&strm,j->inlen)+32;
+	j->out=(unsigned char*)malloc(j->outsize);
+	strm.next_in=j->in;
+	strm.avail_in=j->inlen;
+	strm.next_out=j->out;
+	strm.avail_out=j->outsize;
+	deflate(&strm,Z_FINISH);
+	j->outlen=strm.total_out;
+	deflateEnd(&strm);
+	return;
+}
+
+void inflate_blocks(struct job*j)
+{
+	z_stream strm;
+	long b=0,o=0,bsize;
+	strm.zalloc=Z_NULL;
+	strm.zfree=Z_NULL;
+	strm.opaque=Z_NULL;
+	inflateInit2(&strm,-15); //raw deflate data; the BGZF header and trailer of each block are skipped here
+	while(b<j->inlen)
+	{
+		bsize=(j->in[b+16]|(j->in[b+17]<<8))+1;
+		inflateReset(&strm);
+		strm.next_in=j->in+b+18;
+		strm.avail_in=bsize-26;
+		strm.next_out=j->out+o;
+		strm.avail_out=j->outsize-o;
+		inflate(&strm,Z_FINISH);
+		o+=(j->in[b+bsize-4]|(j->in[b+bsize-3]<<8)|(j->in[b+bsize-2]<<16)|((long)j->in[b+bsize-1]<<24)); //ISIZE field of the block trailer
+		b+=bsize;
+	}
+	j->outlen=o;
+	inflateEnd(&strm);
+	return;
+}
+
+struct gzin*pz_open_in(char*name,struct pipeline*pipe)
+{
+	struct gzin*in=(struct gzin*)malloc(sizeof(struct gzin));
+	unsigned char header[18];
+	in->pipe=pipe;
+	in->head=NULL;
+	in->tail=NULL;
+	in->queued=0;
+	in->eof=0;
+	in->stop=0;
+	in->cur=NULL;
+	in->pos=0;
+	in->raw=fopen(name,"rb");
+	in->bgzf=((in->raw!=NULL)&&(fread(header,1,18,in->raw)==18)&&(header[0]==31)&&(header[1]==139)&&(header[3]&4)&&(header[12]=='B')&&(header[13]=='C'));
+	if(in->raw!=NULL)
+		rewind(in->raw);
+	if(!(in->bgzf))
+	{
+		if(in->raw!=NULL)
+			fclose(in->raw);
+		in->raw=NULL;
+		in->gz=gzopen(name,"r");
+	}
+	pthread_mutex_init(&(in->lock),NULL);
+	pthread_cond_init(&(in->ready),NULL);
+	pthread_cond_init(&(in->space),NULL);
+	pthread_create(&(in->thread),NULL,run_reader,in);
+	return in;
+}
+
+void*run_reader(void*arg)
+{
+	struct gzin*in=(struct gzin*)arg;
+	struct job*j;
+	long bsize,osize;
+	int n,need_inflate;
+	while(1)
+	{
+		j=(struct job*)malloc(sizeof(struct job));
+		j->type=JINFLATE;
+		j->in=NULL;
+		j->inlen=0;
+		j->out=NULL;
+		j->outlen=0;
+		j->done=0;
+		j->onext=NULL;
+		if(in->bgzf)
+		{
+			//gather whole BGZF blocks until the group would exceed the chunk size once decompressed (each block holds at most 64 kb)
+			j->in=(unsigned char*)malloc(RLEN);
+			osize=0;
+			while((j->inlen+65536<=RLEN)&&(osize+65536<=RLEN))
+			{
+				if(fread(j->in+j->inlen,1,18,in->raw)!=18)
+					break;
+				bsize=(j->in[j->inlen+16]|(j->in[j->inlen+17]<<8))+1;
+				if((bsize<26)||(fread(j->in+j->inlen+18,1,bsize-18,in->raw)!=(bsize-18)))
+					break;
+				j->inlen+=bsize;
+				osize+=(j->in[j->inlen-4]|(j->in[j->inlen-3]<<8)|(j->in[j->inlen-2]<<16)|((long)j->in[j->inlen-1]<<24));
+			}
+			if(j->inlen==0)
+			{
+				free_job(j);
+				break;
+			}
+			j->outsize=RLEN;
+			j->out=(unsigned char*)malloc(j->outsize);
+		}
+		else
+		{
+			j->out=(unsigned char*)malloc(RLEN);
+			j->outsize=RLEN;
+			n=gzread(in->gz,j->out,RLEN);
+			if(n<=0)
+			{
+				free_job(j);
+				break;
+			}
+			j->outlen=n;
+			j->done=1;
+		}
+		//note whether the chunk still needs decompressing before publishing it, as the main thread may consume and free it at once
+		need_inflate=!(j->done);
+		pthread_mutex_lock(&(in->lock));
+		while((in->queued>=QLEN)&&(!(in->stop)))
+			pthread_cond_wait(&(in->space),&(in->lock));
+		if(in->stop)
+		{
+			pthread_mutex_unlock(&(in->lock));
+			free_job(j);
+			break;
+		}
+		if(in->tail==NULL)
+			in->head=j;
+		else
+			in->tail->onext=j;
+		in->tail=j;
+		in->queued++;
+		pthread_cond_signal(&(in->ready));
+		pthread_mutex_unlock(&(in->lock));
+		if(need_inflate)
+			submit_job(in->pipe,j);
+	}
+	pthread_mutex_lock(&(in->lock));
+	in->eof=1;
+	pthread_cond_signal(&(in->ready));
+	pthread_mutex_unlock(&(in->lock));
+	return NULL;
+}
+
+int next_chunk(struct gzin*in)
+{
+	if(in->cur!=NULL)
+		free_job(in->cur);
+	in->cur=NULL;
+	in->pos=0;
+	pthread_mutex_lock(&(in->lock));
+	while((in->head==NULL)&&(!(in->eof)))
+		pthread_cond_wait(&(in->ready),&(in->lock));
+	if(in->head!=NULL)
+	{
+		in->cur=in->head;
+		in->head=in->cur->onext;
+		if(in->head==NULL)
+			in->tail=NULL;
+		in->queued--;
+		pthread_cond_signal(&(in->space));
+	}
+	pthread_mutex_unlock(&(in->lock));
+	if(in->cur==NULL)
+		return 0;
+	wait_job(in->pipe,in->cur);
+	return 1;
+}
+
+char*pz_gets(struct gzin*in,char*buf,int len)
+{
+	int n=0,k;
+	unsigned char*nl;
+	while(n<(len-1))
+	{
+		if((in->cur==NULL)||(in->pos>=in->cur->outlen))
+		{
+			if(!(next_chunk(in)))
+				break;
+			continue;
+		}
+		k=in->cur->outlen-in->pos;
+		if(k>(len-1-n))
+			k=len-1-n;
+		nl=memchr(in->cur->out+in->pos,'\n',k);
+		if(nl!=NULL)
+			k=nl-(in->cur->out+in->pos)+1;
+		memcpy(buf+n,in->cur->out+in->pos,k);
+		in->pos+=k;
+		n+=k;
+		if(nl!=NULL)
+			break;
+	}
+	buf[n]='\0';
+	return (n>0)?buf:NULL;
+}
+
+void pz_close_in(struct gzin*in)
+{
+	struct job*j;
+	pthread_mutex_lock(&(in->lock));
+	in->stop=1;
+	pthread_cond_signal(&(in->space));
+	pthread_mutex_unlock(&(in->lock));
+	pthread_join(in->thread,NULL);
+	while(in->head!=NULL)
+	{
+		j=in->head;
+		in->head=j->onext;
+		wait_job(in->pipe,j);
+		free_job(j);
+	}
+	if(in->cur!=NULL)
+		free_job(in->cur);
+	if(in->bgzf)
+		fclose(in->raw);
+	else
+		gzclose(in->gz);
+	free(in);
+	return;
+}
+
+struct gzout*pz_open_out(char*name,struct pipeline*pipe)
+{
+	struct gzout*out=(struct gzout*)malloc(sizeof(struct gzout));
+	out->pipe=pipe;
+	out->file=fopen(name,"wb");
+	if(out->file==NULL)
+	{
+		printf("Unable to open output file %s.\n",name);
+		exit(1);
+	}
+	out->buf=(unsigned char*)malloc(BLEN);
+	out->len=0;
+	out->nblocks=0;
+	return out;
+}
+
+void pz_puts(struct gzout*out,char*str)
+{
+	long n=strlen(str);
+	if(out->len+n>BLEN)
+		pz_flush(out);
+	memcpy(out->buf+out->len,str,n);
+	out->len+=n;
+	return;
+}
+
+void pz_flush(struct gzout*out)
+{
+	struct job*j=(struct job*)malloc(sizeof(struct job));
+	struct pipeline*pipe=out->pipe;
+	j->type=JDEFLATE;
+	j->in=out->buf;
+	j->inlen=out->len;
+	j->out=NULL;
+	j->outlen=0;
+	j->done=0;
+	j->dest=out;
+	j->onext=NULL;
+	out->buf=(unsigned char*)malloc(BLEN);
+	out->len=0;
+	out->nblocks++;
+	queue_write(pipe,j);
+	submit_job(pipe,j);
+	return;
+}
+
+void pz_close_out(struct gzout*out)
+{
+	struct job*j;
+	if((out->len>0)||(out->nblocks==0)) //an empty output file still gets a valid (empty) gzip member
+		pz_flush(out);
+	j=(struct job*)malloc(sizeof(struct job));
+	j->type=JCLOSE;
+	j->in=NULL;
+	j->out=NULL;
+	j->done=1;
+	j->dest=out;
+	j->onext=NULL;
+	queue_write(out->pipe,j); //the writer thread closes the file and frees its buffers once all preceding blocks are written
+	return;
+}
+
+void queue_write(struct pipeline*pipe,struct job*j)
+{
+	pthread_mutex_lock(&(pipe->lock));
+	while(pipe->wqueued>=pipe->wmax)
+		pthread_cond_wait(&(pipe->space),&(pipe->lock));
+	if(pipe->wtail==NULL)
+		pipe->whead=j;
+	else
+		pipe->wtail->onext=j;
+	pipe->wtail=j;
+	pipe->wqueued++;
+	pthread_cond_signal(&(pipe->ready));
+	pthread_mutex_unlock(&(pipe->lock));
+	return;
+}
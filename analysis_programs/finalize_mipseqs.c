@@ -7,6 +7,10 @@
 //
 //depth_cutoff = minimum molecular tag count; all sequences with fewer corresponding tag counts will be discarded
 //allele_fraction_cutoff = minimum allele fraction; all sequences with a lower allele fraction (after discarding sequences below the depth cutoff) will be discarded
+//
+//To compare several cutoffs, comma-separated lists of depth cutoffs and/or allele fraction cutoffs may be given (e.g., "5,10,20" "0.05,0.1").
+//The seqcounts file is then read once, the sequences at each MIP target are sorted once, and a separate finalseqs file is generated for every
+//combination of depth and allele fraction cutoffs (e.g., sample.dp5.af0.05.finalseqs.gz, sample.dp5.af0.1.finalseqs.gz, etc.).
 
 #include<stdio.h>
 #include<string.h>
@@ -15,69 +19,120 @@
 #define NLEN 200 //maximum length of names (sample, MIP, contig, mipseqs file) and of mapping coordinate converted to a string
 #define SLEN 500 //maximum length of each sequence array (and corresponding quality array)
 #define LLEN 1500 //maximum length of single line of text in input seqcounts file
+#define ABLOCK 1048576 //size of each block of memory from which the lines of each group of sequences are allocated
+#define NFIELDS 9 //number of columns in the seqcounts file
 
-//set up structure to store data for each sequence at a guide target
+//set up structure to store data for each sequence at a guide target; strings point into a copy of the sequence's input line
 struct mipseq
 {
-	char mip[NLEN+1];
-	char miptype[NLEN+1];
-	char crispr[NLEN+1];
-	char contig[NLEN+1];
-  char maploc[NLEN+1];
-  char seq[SLEN+1];
-  char qual[SLEN+1];
-  long tagcount;
-  double tagfreq;
+	char*mip;
+	char*miptype;
+	char*crispr;
+	char*contig;
+	char*maploc;
+	char*seq;
+	char*qual;
+	long tagcount;
+};
+
+//set up structure to store a bump allocator for the input lines of the current group of sequences; blocks are kept and reused
+//from the start for each new group
+struct arena
+{
+	char**blocks;
+	long nblocks;
+	long cur; //block currently being allocated from
+	long used; //number of bytes used in the current block
+};
+
+//set up structure to store one group of sequences (all sequences at one MIP target) read from the input file; the input is only read
+//forwards, so the first line of the next group is held in nextline until that group is read
+struct seqgroup
+{
+	struct mipseq*seqs;
+	long nseqs;
+	long maxseqs;
+	struct arena lines;
+	char nextline[LLEN+1];
+	int hasnext;
 };
 
 gzFile* init_output(gzFile*fseqs,char*basename,long dp,double af,char*afstr);
-int countseqs(gzFile*scounts,char*lyne,long*numseqs);
-void get_seqs(gzFile*scounts,char*lyne,long numseqs,struct mipseq*sequences);
+int get_group(gzFile*scounts,struct seqgroup*group);
+void split_line(char*lyne,struct mipseq*sequence);
+char*arena_alloc(struct arena*mem,long nbytes);
+void free_arena(struct arena*mem);
+long count_cutoffs(char*cutoffs);
 int compfun(const void*p1,const void*p2);
-void filter_dp(struct mipseq*sequences,long numseqs,long dp);
-long counttags(struct mipseq*sequences,long numseqs);
-void filter_af(struct mipseq*sequences,long numseqs,double af,long count);
-void print_seqs(gzFile*fseqs,char*samp,struct mipseq*sequences,long numseqs);
+void print_seqs(gzFile*fseqs,char*samp,struct mipseq*sequences,long numseqs,long dp,double af);
 
 int main(int argc,char*argv[])
 {
-	//get sample name, depth cutoff, and allele fraction cutoff from command line
+	//get sample name, depth cutoff(s), and allele fraction cutoff(s) from command line
 	char sample[NLEN+1];
 	strncpy(sample,*(argv+1),NLEN-30); //leave up to 30 characters for new extension
 	sample[strchr(sample,'.')-sample]='\0';
-	long mindp=strtol(*(argv+2),NULL,10);
-	double minaf=strtod(*(argv+3),NULL);
+	long ndps=count_cutoffs(*(argv+2));
+	long nafs=count_cutoffs(*(argv+3));
+	long*mindps=(long*)malloc(ndps*sizeof(long));
+	double*minafs=(double*)malloc(nafs*sizeof(double));
+	char**afstrs=(char**)malloc(nafs*sizeof(char*));
+	long d,a;
+	char*cutoff=strtok(*(argv+2),",");
+	for(d=0;d<ndps;d++)
+	{
+		mindps[d]=strtol(cutoff,NULL,10);
+		cutoff=strtok(NULL,",");
+	}
+	cutoff=strtok(*(argv+3),",");
+	for(a=0;a<nafs;a++)
+	{
+		afstrs[a]=cutoff;
+		minafs[a]=strtod(cutoff,NULL);
+		cutoff=strtok(NULL,",");
+	}
 
-	//set up output file
-	gzFile*finalseqs=init_output(finalseqs,sample,mindp,minaf,*(argv+3));
+	//set up an output file for each combination of depth and allele fraction cutoffs
+	gzFile**finalseqs=(gzFile**)malloc(ndps*nafs*sizeof(gzFile*));
+	for(d=0;d<ndps;d++)
+	{
+		for(a=0;a<nafs;a++)
+			finalseqs[d*nafs+a]=init_output(finalseqs[d*nafs+a],sample,mindps[d],minafs[a],afstrs[a]);
+	}
 
 	//read in mipseqs and associated tag counts from seqcounts file, processing them in groups based on their associated MIP target	
-	char line[LLEN+1];
-	long nseqs,ntags;
+	long nseqs;
 	struct mipseq*seqs;
+	struct seqgroup group={NULL,0,0,{NULL,0,0,0},"",0};
 	gzFile*seqcounts=gzopen(*(argv+1),"r");	
-	gzgets(seqcounts,line,LLEN-1); //process header line
-	while(countseqs(seqcounts,line,&nseqs))
+	gzgets(seqcounts,group.nextline,LLEN-1); //process header line
+	group.hasnext=(gzgets(seqcounts,group.nextline,LLEN-1)!=NULL);
+	while(get_group(seqcounts,&group))
 	{
 		//read sequences into array of mipseq structures
-		seqs=(struct mipseq*)malloc(nseqs*sizeof(struct mipseq));
-		get_seqs(seqcounts,line,nseqs,seqs);
+		seqs=group.seqs;
+		nseqs=group.nseqs;
 
 		//sort array of mipseq structures based on tagcount numbers
 		qsort(seqs,nseqs,sizeof(struct mipseq),compfun);
 
-		//filter out sequences based on molecular tag count depth and allele balance
-		filter_dp(seqs,nseqs,mindp);		
-		ntags=counttags(seqs,nseqs);
-		filter_af(seqs,nseqs,minaf,ntags);
-
-		//print remaining sequences to output file and free memory used to store data for current set of sequences
-		print_seqs(finalseqs,sample,seqs,nseqs);
-		free(seqs);
+		//filter out sequences based on molecular tag count depth and allele balance and print remaining sequences to output files
+		for(d=0;d<ndps;d++)
+		{
+			for(a=0;a<nafs;a++)
+				print_seqs(finalseqs[d*nafs+a],sample,seqs,nseqs,mindps[d],minafs[a]);
+		}
 	}
 
 	//clean up and exit
-	gzclose(finalseqs);
+	free(group.seqs);
+	free_arena(&(group.lines));
+	for(d=0;d<ndps*nafs;d++)
+		gzclose(finalseqs[d]);
+	free(finalseqs);
+	free(mindps);
+	free(minafs);
+	free(afstrs);
 	gzclose(seqcounts);
 	return 0;
 }
@@ -91,95 +146,119 @@ gzFile* init_output(gzFile*fseqs,char*basename,long dp,double af,char*afstr)
 	return fseqs;
 }
 
-int countseqs(gzFile*scounts,char*lyne,long*numseqs)
+int get_group(gzFile*scounts,struct seqgroup*group)
 {
-	char mipone[NLEN+1],newmip[NLEN+1];
-	long offset=0;
-	(*numseqs)=0;
-	while(gzgets(scounts,lyne,LLEN-1))
+	char newmip[NLEN+1];
+	char*copy;
+	group->nseqs=0;
+	group->lines.cur=0;
+	group->lines.used=0;
+	if(!(group->hasnext))
+		return 0;
+	do
 	{
-		offset+=strlen(lyne);
-		if((*numseqs)==0)
+		if(group->nseqs==group->maxseqs)
 		{
-			sscanf(lyne,"%*s %s",mipone);
-			(*numseqs)++;
-			continue;
+			group->maxseqs=(group->maxseqs==0)?16:2*group->maxseqs;
+			group->seqs=(struct mipseq*)realloc(group->seqs,group->maxseqs*sizeof(struct mipseq));
 		}
-		sscanf(lyne,"%*s %s",newmip);
-		if(strncmp(newmip,mipone,NLEN)==0)
-			(*numseqs)++;
-		else
-			break;
+		copy=arena_alloc(&(group->lines),strlen(group->nextline)+1);
+		strcpy(copy,group->nextline);
+		split_line(copy,&(group->seqs[group->nseqs]));
+		group->nseqs++;
+		group->hasnext=(gzgets(scounts,group->nextline,LLEN-1)!=NULL);
 	}
-	gzseek(scounts,(-1*offset),SEEK_CUR);
-	return ((*numseqs)>0);
+	while((group->hasnext)&&((sscanf(group->nextline,"%*s %s",newmip)!=1)||(strncmp(newmip,group->seqs[0].mip,NLEN)==0)));
+	return 1;
 }
 
-void get_seqs(gzFile*scounts,char*lyne,long numseqs,struct mipseq*sequences)
+void split_line(char*lyne,struct mipseq*sequence)
 {
-	long s;
-	for(s=0;s<numseqs;s++)
+	char*fields[NFIELDS];
+	long f;
+	for(f=0;f<NFIELDS;f++)
 	{
-		gzgets(scounts,lyne,LLEN-1);
-		sscanf(lyne,"%*s %s %s %s %s %s %s %s %ld",sequences[s].mip,sequences[s].miptype,sequences[s].crispr,sequences[s].contig,sequences[s].maploc,sequences[s].seq,sequences[s].qual,&(sequences[s].tagcount));
-		sequences[s].tagfreq=0.0;
+		lyne+=strspn(lyne," \t\r\n");
+		fields[f]=lyne;
+		lyne+=strcspn(lyne," \t\r\n");
+		if(*lyne!='\0')
+			*(lyne++)='\0';
 	}
+	sequence->mip=fields[1];
+	sequence->miptype=fields[2];
+	sequence->crispr=fields[3];
+	sequence->contig=fields[4];
+	sequence->maploc=fields[5];
+	sequence->seq=fields[6];
+	sequence->qual=fields[7];
+	sequence->tagcount=strtol(fields[8],NULL,10);
 	return;
 }
 
-int compfun(const void*p1,const void*p2)
-{
-	const struct mipseq*seq1=p1;
-	const struct mipseq*seq2=p2;
-	if(seq1->tagcount<seq2->tagcount)
-    return 1;
-  else if(seq2->tagcount<seq1->tagcount)
-    return -1;
-	else
-		return 0;
-}
-
-void filter_dp(struct mipseq*sequences,long numseqs,long dp)
+char*arena_alloc(struct arena*mem,long nbytes)
 {
-	long s;
-	for(s=0;s<numseqs;s++)
+	if((mem->nblocks==0)||(mem->used+nbytes>ABLOCK))
 	{
-		if(sequences[s].tagcount<dp)
-			sequences[s].tagcount=0;
+		if(mem->nblocks>0)
+			mem->cur++;
+		if(mem->cur==mem->nblocks)
+		{
+			mem->blocks=(char**)realloc(mem->blocks,(mem->nblocks+1)*sizeof(char*));
+			mem->blocks[mem->nblocks]=(char*)malloc(ABLOCK);
+			mem->nblocks++;
+		}
+		mem->used=0;
 	}
-	return;
+	mem->used+=nbytes;
+	return mem->blocks[mem->cur]+mem->used-nbytes;
 }
 
-long counttags(struct mipseq*sequences,long numseqs)
+void free_arena(struct arena*mem)
 {
-	long s,count=0;
-	for(s=0;s<numseqs;s++)
-		count+=sequences[s].tagcount;
-	return count;
+	long b;
+	for(b=0;b<mem->nblocks;b++)
+		free(mem->blocks[b]);
+	free(mem->blocks);
+	return;
 }
 
-void filter_af(struct mipseq*sequences,long numseqs,double af,long count)
+long count_cutoffs(char*cutoffs)
 {
-	long s;
-	for(s=0;s<numseqs;s++)
+	long n=1;
+	for(;*cutoffs!='\0';cutoffs++)
 	{
-		sequences[s].tagfreq=(double)sequences[s].tagcount/(double)count;
-		if(sequences[s].tagfreq<af)
-			sequences[s].tagcount=0;
+		if(*cutoffs==',')
+			n++;
 	}
-	return;
+	return n;
 }
 
-void print_seqs(gzFile*fseqs,char*samp,struct mipseq*sequences,long numseqs)
+int compfun(const void*p1,const void*p2)
 {
-	long s;
-	for(s=0;s<numseqs;s++)
+	const struct mipseq*seq1=p1;
+	const struct mipseq*seq2=p2;
+	if(seq1->tagcount<seq2->tagcount)
+    return 1;
+  else if(seq2->tagcount<seq1->tagcount)
+    return -1;
+	else
+		return 0;
+}
+
+void print_seqs(gzFile*fseqs,char*samp,struct mipseq*sequences,long numseqs,long dp,double af)
+{
+	long s,n,count=0;
+	double tagfreq;
+
+	//sequences are sorted by tag count, so those passing the depth cutoff come first; their tag counts sum to the total used for allele fractions
+	for(n=0;(n<numseqs)&&(sequences[n].tagcount>=dp);n++)
+		count+=sequences[n].tagcount;
+	for(s=0;(s<n)&&(sequences[s].tagcount>0);s++)
 	{
-		if(sequences[s].tagcount>0)
-			gzprintf(fseqs,"%s\t%s\t%s\t%s\t%s\t%s\t%s\t%s\t%ld\t%lf\n",samp,sequences[s].mip,sequences[s].miptype,sequences[s].crispr,sequences[s].contig,sequences[s].maploc,sequences[s].seq,sequences[s].qual,sequences[s].tagcount,sequences[s].tagfreq);
-		else
+		tagfreq=(double)sequences[s].tagcount/(double)count;
+		if(tagfreq<af)
 			break;
+		gzprintf(fseqs,"%s\t%s\t%s\t%s\t%s\t%s\t%s\t%s\t%ld\t%lf\n",samp,sequences[s].mip,sequences[s].miptype,sequences[s].crispr,sequences[s].contig,sequences[s].maploc,sequences[s].seq,sequences[s].qual,sequences[s].tagcount,tagfreq);
 	}
 	return;
 }
-
@@ -19,24 +19,50 @@
 #define NLEN 200 //maximum length of names (sample, MIP, contig, mipseqs file) and of mapping coordinate converted to a string
 #define LLEN 1500 //maximum length of single line of text in input finalseqs file
 #define SLEN 500 //maximum length of each sequence array (and corresponding quality array)
+#define ABLOCK 1048576 //size of each block of memory from which the lines of each group of sequences are allocated
+#define NFIELDS 10 //number of columns in the finalseqs file
 
-//set up structure to store data for each sequence at a guide target
+//set up structure to store data for each sequence at a guide target; strings point into a copy of the sequence's input line
 struct mipseq
 {
-	char mip[NLEN+1];
+	char*mip;
 	char miptype;
-	char crispr[NLEN+1];
-	char contig[NLEN+1];
-	char maploc[NLEN+1];
-	char seq[SLEN+1];
-	char qual[SLEN+1];
+	char*crispr;
+	char*contig;
+	char*maploc;
+	char*seq;
+	char*qual;
 	long tagcount;
-	char tagfreq[SLEN+1];
+	char*tagfreq;
+};
+
+//set up structure to store a bump allocator for the input lines of the current group of sequences; blocks are kept and reused
+//from the start for each new group
+struct arena
+{
+	char**blocks;
+	long nblocks;
+	long cur; //block currently being allocated from
+	long used; //number of bytes used in the current block
+};
+
+//set up structure to store one group of sequences (all sequences at one MIP target) read from the input file; the input is only read
+//forwards, so the first line of the next group is held in nextline until that group is read
+struct seqgroup
+{
+	struct mipseq*seqs;
+	long nseqs;
+	long maxseqs;
+	struct arena lines;
+	char nextline[LLEN+1];
+	int hasnext;
 };
 
 FILE*init_output(FILE*out,char*basename);
-int countseqs(gzFile*fseqs,char*lyne,long*numseqs);
-void get_seqs(gzFile*fseqs,char*lyne,long numseqs,struct mipseq*sequences);
+int get_group(gzFile*fseqs,struct seqgroup*group);
+void split_line(char*lyne,struct mipseq*sequence);
+char*arena_alloc(struct arena*mem,long nbytes);
+void free_arena(struct arena*mem);
 int informative(struct mipseq*sequences,char*samp);
 void print_seqs(FILE*out,char*samp,struct mipseq*sequences,long numseqs);
 
@@ -51,24 +77,26 @@ int main(int argc,char*argv[])
 	FILE*mipcounts=init_output(mipcounts,sample);
 
 	//read in data for finalized MIP sequences, processing them in groups based on their associated MIP target
-	char line[LLEN+1];
 	long nseqs;
 	struct mipseq*seqs;
+	struct seqgroup group={NULL,0,0,{NULL,0,0,0},"",0};
 	gzFile*finalseqs=gzopen(*(argv+1),"r");
-	gzgets(finalseqs,line,LLEN-1); //process header line
-	while(countseqs(finalseqs,line,&nseqs))
+	gzgets(finalseqs,group.nextline,LLEN-1); //process header line
+	group.hasnext=(gzgets(finalseqs,group.nextline,LLEN-1)!=NULL);
+	while(get_group(finalseqs,&group))
 	{
 		//read sequences into array of mipseq structures
-		seqs=(struct mipseq*)malloc(nseqs*sizeof(struct mipseq));
-		get_seqs(finalseqs,line,nseqs,seqs);
+		seqs=group.seqs;
+		nseqs=group.nseqs;
 
 		//if MIP is informative for copy number genotyping, print data from two most abundant sequences (based on tag counts) to output
 		if(informative(seqs,sample))
 			print_seqs(mipcounts,sample,seqs,nseqs);
-		free(seqs);
 	}
 
 	//clean up and exit
+	free(group.seqs);
+	free_arena(&(group.lines));
 	fclose(mipcounts);
 	gzclose(finalseqs);
 	return 0;
@@ -83,38 +111,80 @@ FILE*init_output(FILE*out,char*basename)
 	return out;
 }
 
-int countseqs(gzFile*fseqs,char*lyne,long*numseqs)
+int get_group(gzFile*fseqs,struct seqgroup*group)
 {
-	char mipone[NLEN+1],newmip[NLEN+1];
-	long offset=0;
-	(*numseqs)=0;
-	while(gzgets(fseqs,lyne,LLEN-1))
+	char newmip[NLEN+1];
+	char*copy;
+	group->nseqs=0;
+	group->lines.cur=0;
+	group->lines.used=0;
+	if(!(group->hasnext))
+		return 0;
+	do
 	{
-		offset+=strlen(lyne);
-		if((*numseqs)==0)
+		if(group->nseqs==group->maxseqs)
 		{
-			sscanf(lyne,"%*s %s",mipone);
-			(*numseqs)++;
-			continue;
+			group->maxseqs=(group->maxseqs==0)?16:2*group->maxseqs;
+			group->seqs=(struct mipseq*)realloc(group->seqs,group->maxseqs*sizeof(struct mipseq));
 		}
-		sscanf(lyne,"%*s %s",newmip);
-		if(strncmp(newmip,mipone,NLEN)==0)
-			(*numseqs)++;
-		else
-			break;
+		copy=arena_alloc(&(group->lines),strlen(group->nextline)+1);
+		strcpy(copy,group->nextline);
+		split_line(copy,&(group->seqs[group->nseqs]));
+		group->nseqs++;
+		group->hasnext=(gzgets(fseqs,group->nextline,LLEN-1)!=NULL);
+	}
+	while((group->hasnext)&&((sscanf(group->nextline,"%*s %s",newmip)!=1)||(strncmp(newmip,group->seqs[0].mip,NLEN)==0)));
+	return 1;
+}
+
+void split_line(char*lyne,struct mipseq*sequence)
+{
+	char*fields[NFIELDS];
+	long f;
+	for(f=0;f<NFIELDS;f++)
+	{
+		lyne+=strspn(lyne," \t\r\n");
+		fields[f]=lyne;
+		lyne+=strcspn(lyne," \t\r\n");
+		if(*lyne!='\0')
+			*(lyne++)='\0';
 	}
-	gzseek(fseqs,(-1*offset),SEEK_CUR);
-	return ((*numseqs)>0);
+	sequence->mip=fields[1];
+	sequence->miptype=fields[2][0];
+	sequence->crispr=fields[3];
+	sequence->contig=fields[4];
+	sequence->maploc=fields[5];
+	sequence->seq=fields[6];
+	sequence->qual=fields[7];
+	sequence->tagcount=strtol(fields[8],NULL,10);
+	sequence->tagfreq=fields[9];
+	return;
 }
 
-void get_seqs(gzFile*fseqs,char*lyne,long numseqs,struct mipseq*sequences)
+char*arena_alloc(struct arena*mem,long nbytes)
 {
-	long s;
-	for(s=0;s<numseqs;s++)
+	if((mem->nblocks==0)||(mem->used+nbytes>ABLOCK))
 	{
-		gzgets(fseqs,lyne,LLEN-1);
-		sscanf(lyne,"%*s %s %c %s %s %s %s %s %ld %s",sequences[s].mip,&(sequences[s].miptype),sequences[s].crispr,sequences[s].contig,sequences[s].maploc,sequences[s].seq,sequences[s].qual,&(sequences[s].tagcount),sequences[s].tagfreq);
+		if(mem->nblocks>0)
+			mem->cur++;
+		if(mem->cur==mem->nblocks)
+		{
+			mem->blocks=(char**)realloc(mem->blocks,(mem->nblocks+1)*sizeof(char*));
+			mem->blocks[mem->nblocks]=(char*)malloc(ABLOCK);
+			mem->nblocks++;
+		}
+		mem->used=0;
 	}
+	mem->used+=nbytes;
+	return mem->blocks[mem->cur]+mem->used-nbytes;
+}
+
+void free_arena(struct arena*mem)
+{
+	long b;
+	for(b=0;b<mem->nblocks;b++)
+		free(mem->blocks[b]);
+	free(mem->blocks);
 	return;
 }
 
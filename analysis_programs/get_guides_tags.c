@@ -1,12 +1,11 @@
 //Xander Nuttle
 //get_guides_tags.c
-//Call: ./get_guides_tags gzipped_finalseqs_file guides_table
+//Call: ./get_guides_tags gzipped_finalseqs_file
 //
 //This program analyzes finalized MIP sequence data to extract molecular tag information associated with each integrated
 //guide RNA construct (assumes a molecularly-tagged indel guide library was used along with a MIP to capture guide sequences and
 //associated molecular tags). This information can then be used for rarefaction analysis to assess diversity of integrated
-//guide constructs. The guides table file is a headerless, tab-delimited text file with the first column containing names of all tagged guides
-//and the second column containing guide sequences.
+//guide constructs.
 
 #include<stdio.h>
 #include<string.h>
@@ -34,17 +33,8 @@ struct mipseq
 	char gtag[TLEN+1];
 };
 
-//set up structure to store data for each guide
-struct guide
-{
-	char name[NLEN+1];
-	char seq[SLEN+1];
-};
-
-long count_guides(FILE*glist);
-void get_guides(FILE*glist,struct guide*gyds);
 int getinput(gzFile*fseqs,struct mipseq*iseq);
-void process(char*samp,struct mipseq*iseq,struct guide*gyds,long numguides);
+void process(char*samp,struct mipseq*iseq);
 void parse_seq(char*seq,char*newseq,long*rbases);
 void parse_match(char*orig,char*new,long*rb,long*o,long*n,long*r);
 void parse_ins(char*orig,char*new,long*rb,long*o,long*n,long*r);
@@ -59,47 +49,18 @@ int main(int argc,char*argv[])
 	strncpy(sample,*(argv+1),NLEN);
 	sample[strchr(sample,'.')-sample]='\0';
 
-	//determine the number of guides and allocate memory to store guide information
-	FILE*guidelist=fopen(*(argv+2),"r");
-	long nguides=count_guides(guidelist);
-	struct guide*guides;
-	guides=(struct guide*)malloc(nguides*sizeof(struct guide));
-	
-	//read in information on guides
-	get_guides(guidelist,guides);
-
 	//read in final called MIP sequences and process them one by one
 	gzFile*finalseqs=gzopen(*(argv+1),"r");
 	struct mipseq inseq;
 	getinput(finalseqs,&inseq); //process header line
 	while(getinput(finalseqs,&inseq))
-		process(sample,&inseq,guides,nguides);
+		process(sample,&inseq);
 
 	//clean up and exit
 	gzclose(finalseqs);
 	return 0;
 }
 
-long count_guides(FILE*glist)
-{
-	long numguides=0;
-  char gname[NLEN+1];
-  fpos_t pos;
-  fgetpos(glist,&pos);
-  while(fscanf(glist,"%s %*s",gname)==1)
-    numguides++;
-  fsetpos(glist,&pos);
-  return numguides;
-}
-
-void get_guides(FILE*glist,struct guide*gyds)
-{
-	long g=0;
-	while(fscanf(glist,"%s %s",gyds[g].name,gyds[g].seq)==2)
-		g++;
-	return;
-}
-
 int getinput(gzFile*fseqs,struct mipseq*iseq)
 {
 	char line[LLEN+1];
@@ -109,20 +70,15 @@ int getinput(gzFile*fseqs,struct mipseq*iseq)
 	return (scanned==9);
 }
 
-void process(char*samp,struct mipseq*iseq,struct guide*gyds,long numguides)
+void process(char*samp,struct mipseq*iseq)
 {
 	char newseq[SLEN+1];
 	long refbases[SLEN+1];
-	long b,g,tag_reached=0;
+	long b,tag_reached=0;
 	char base;
 	char*pretag;
 	if((strstr(iseq->mip,"_guide_"))&&(strstr(iseq->mip,"_MIP_0002")))
 	{
-		for(g=0;g<numguides;g++)
-		{
-			if(strncmp(iseq->contig,gyds[g].name,NLEN)==0)
-				break;
-		}
 		parse_seq(iseq->seq,newseq,refbases);
 		for(b=0;b<strlen(newseq);b++)
 		{
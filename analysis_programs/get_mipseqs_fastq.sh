@@ -0,0 +1,26 @@
+#!/usr/bin/env bash
+
+#Xander Nuttle
+#get_mipseqs_fastq.sh
+#Call: /data/talkowski/xander/MIPs/analysis_programs/get_mipseqs_fastq.sh gzipped_merged_fastq_file miptargets_file genome_fasta_file unassigned_reads_directory
+#
+#Differs from get_mipseqs.sh in that reads are assigned to MIPs directly from merged fastq files rather than from bwa mapping output.
+#Reads which cannot be assigned (sample_unassigned.fastq.gz) are moved to the unassigned reads directory for mapping with bwa and
+#analysis with get_mipseqs.sh as usual.
+
+REFERENCE_DIR=/var/tmp/xnuttle
+CURRENT_DIR=$(pwd)
+MFILE_NAME=$(basename ${2})
+FASTA_NAME=$(basename ${3})
+SAMP_NAME=$(basename ${1} .fastq.gz)
+
+mkdir -p $REFERENCE_DIR
+chgrp -R miket $REFERENCE_DIR
+rsync -a --bwlimit=500 $CURRENT_DIR/$1 $REFERENCE_DIR
+rsync -a --bwlimit=500 $2 $REFERENCE_DIR
+rsync -a --bwlimit=10000 $3 $REFERENCE_DIR
+cd $REFERENCE_DIR
+/data/talkowski/xander/MIPs/analysis_programs/mip_seq_analysis $1 $MFILE_NAME $FASTA_NAME
+mv $REFERENCE_DIR/${SAMP_NAME}.mipseqs.gz $CURRENT_DIR
+mv $REFERENCE_DIR/${SAMP_NAME}_unassigned.fastq.gz $4
+rm $REFERENCE_DIR/${SAMP_NAME}*
@@ -1,6 +1,6 @@
 #Xander Nuttle
 #makejob_fastq_prep.sh
-#Call: bash /data/talkowski/xander/MIPs/analysis_programs/makejob_fastq_prep.sh merging_input_directory molecular_tag_length
+#Call: bash /data/talkowski/xander/MIPs/analysis_programs/makejob_fastq_prep.sh merging_input_directory molecular_tag_length <miptargets_file>
 
 NSETS=$(cat samplesets.txt|wc -l)
 echo "#!/usr/bin/env bash" >> prepjobs.sh
@@ -14,5 +14,5 @@ echo "#BSUB -W 5:0" >> prepjobs.sh
 echo "#BSUB -cwd $(pwd)" >> prepjobs.sh
 echo "#BSUB -sp 80" >> prepjobs.sh
 echo "#BSUB -q medium" >> prepjobs.sh
-echo "/data/talkowski/xander/MIPs/analysis_programs/prep_fastqs.sh \`awk \"NR == \$LSB_JOBINDEX\" samplesets.txt \` $1 $2" >> prepjobs.sh
+echo "/data/talkowski/xander/MIPs/analysis_programs/prep_fastqs.sh \`awk \"NR == \$LSB_JOBINDEX\" samplesets.txt \` $1 $2 $3" >> prepjobs.sh
 
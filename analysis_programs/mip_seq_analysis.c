@@ -1,6 +1,7 @@
 //Xander Nuttle
 //mip_seq_analysis.c
 //Call: ./mip_seq_analysis gzipped_sam_file miptargets_file <(double)mapping_location_wiggle_room>
+//  or: ./mip_seq_analysis gzipped_merged_fastq_file miptargets_file genome_fasta_file <(double)mapping_location_wiggle_room>
 //
 //This program analyzes reads in a gzipped sam mapping output file generated in a MIP experiment.
 //It assigns each read to a MIP target of interest, annotates sequence variation in an easily parsed
@@ -13,17 +14,41 @@
 //it may be appropriate to adjust this value via a third optional command line argument. For example, if
 //you have multiple MIPs with targets shifted by a few bases or less, setting this value to zero would
 //allow you to keep sequences corresponding to these nearby MIP targets separate for further analysis.
+//
+//Given a gzipped fastq file of merged reads (any input file name ending in ".fastq.gz") and the genome fasta file the MIPs were designed
+//against, this program assigns reads to MIPs without mapping. The first and last 16 bases of each MIP's captured sequence (its
+//hybridization arms) are loaded into hash tables, and each read (or its reverse complement) is looked up by its first and last 16 bases.
+//Each read is compared to the captured sequence of each candidate MIP without gaps if the two are the same length, and is otherwise
+//aligned to it with a banded global alignment. A same-length read differing from the captured sequence at more than two bases is also
+//aligned with gaps, and the alignment with the better score (using bwa mem's default scores) is kept, so that an indel together with a
+//nearby compensating indel is reported as such rather than as a run of mismatches. A read is assigned to a candidate MIP if the alignment has mismatches and gaps at no more
+//than 10% of read length, and its cs-formatted sequence and quality strings are then generated directly from the alignment, just as for a
+//read mapped to the start of the captured sequence with no soft clipping. Reads which cannot be assigned this way are printed to a gzipped
+//fastq file (sample_unassigned.fastq.gz) which can be mapped with bwa and analyzed with this program as usual.
 
 #include<stdio.h>
 #include<stdlib.h>
 #include<string.h>
 #include<ctype.h>
 #include<zlib.h>
+#ifdef __SSE2__
+#include<emmintrin.h>
+#endif
 #define NLEN 200 //size of character vectors for storing names, etc.
 #define SLEN 500 //size of character vectors for storing sequence and quality strings 
 #define TLEN 8 //length of molecular tag sequences
 #define LLEN 1501 //maximum length of single line of text in mapping output (gzipped sam) file + 1
 #define MWIG 4.5 //default mapping location wiggle room
+#define KLEN 16 //length of the sequences at each end of reads used to look up candidate MIPs
+#define MAXMMFRAC 0.1 //maximum number of mismatches and gaps in the alignment of a read to the captured sequence of its MIP, as a fraction of read length
+#define BAND 40 //number of diagonals on either side of the main diagonals searched when aligning reads to captured sequences
+#define EXTSLACK 8 //reads are aligned to candidate MIPs matching them from either end without gaps at no more than this many fewer bases than the best candidate
+#define GAPLESSMM 2 //reads compared to a captured sequence without gaps at more than this many mismatches are also aligned to it with gaps
+#define MATCH 1 //alignment scores (bwa mem defaults); a gap of length k scores -(GAPO+k*GAPE)
+#define MISMATCH 4
+#define GAPO 6
+#define GAPE 1
+#define NEGINF -1000000000
 
 //set up structure to store MIP target information
 struct miptarg
@@ -31,11 +56,52 @@ struct miptarg
 	char name[NLEN+1];
 	char contig[NLEN+1];
 	long start;
+	long end;
 	char type;
 	char crispr[NLEN+1];
 	long tstart;
 	long armlen;
 	long tlength;
+	char*window; //captured sequence, including both hybridization arms, in the orientation of the genome
+	long contigid;
+};
+
+//set up structure to store a MIP target's position in the list of MIP targets sorted by contig and start coordinate
+struct targpos
+{
+	long contigid;
+	long start;
+	long targ;
+};
+
+//set up structure to store an index of MIP targets by location; contig names are assigned integer IDs via a hash table, and MIP targets
+//on each contig are sorted by start coordinate so those near a mapping location can be found by binary search
+struct targindex
+{
+	long*contigs; //hash table of contig IDs
+	long size;
+	long*reps; //the first MIP target listed on each contig, whose contig name is used to resolve hash table lookups
+	long ncontigs;
+	long*first; //position in the sorted list of the first MIP target on each contig, with first[ncontigs] marking the end of the list
+	struct targpos*sorted;
+};
+
+//set up structure to store the position reached in parsing the MD tag of a read; a count of matching bases is removed from the tag
+//as soon as it is parsed and kept in nmatch as bases are used up, so the rest of the tag is never copied
+struct mdcursor
+{
+	char*p;
+	long nmatch;
+	int hasnum;
+	char buf[SLEN+30];
+};
+
+//set up structure to store hash tables of the first and last KLEN bases of the captured sequence of each MIP target
+struct armindex
+{
+	unsigned int*kmers;
+	long*targs;
+	long size;
 };
 
 //set up structure to store read information
@@ -50,19 +116,56 @@ struct readdata
 	char tag[TLEN+1];
 };
 
+//set up structure to store dynamic programming matrices used to align reads to captured sequences
+struct dpmatrix
+{
+	int*h;
+	int*e;
+	int*f;
+	long*cands; //candidate MIP targets for a read
+	long*exts; //number of bases of the read matching each candidate's captured sequence from either end
+};
+
+//set up structure to store merged read information
+struct fastqdata
+{
+	char name[LLEN];
+	char seq[SLEN+1];
+	char qual[SLEN+1];
+	long length;
+	char tag[TLEN+1];
+};
+
 gzFile* init_output(gzFile*mseqs,char*basename);
 long count_targs(FILE*mtargs);
 void get_targ_info(FILE*mtargs,struct miptarg*targs);
 int getread(gzFile*samgz,struct readdata*reed);
-void parseread(struct readdata*reed,struct miptarg*targs,long numtargs,gzFile*mseqs,char*samp,double wigg);
-long findtarg(char*chr,long coord,struct miptarg*miptargets,long numtargets,double wig);
+void parseread(struct readdata*reed,struct miptarg*targs,struct targindex*tindex,gzFile*mseqs,char*samp,double wigg);
+void build_targindex(struct targindex*index,struct miptarg*targs,long numtargs);
+unsigned long hash_contig(char*chr);
+long findcontig(char*chr,struct miptarg*targs,struct targindex*index);
+int compare_targpos(const void*a,const void*b);
+long findtarg(char*chr,long coord,struct miptarg*miptargets,struct targindex*index,double wig);
 void parse_aln(char*cigar,char*md,char*readseq,char*readqual,long maploc,long targloc,long targlength,char*csseq,char*csqual);
-void makecs(char aln,long nbases,long*t_index,long*r_index,char*mdtag,char*rseq,char*rqual,char*seqcs,char*qualcs,long targlen);
-void parse_mapped(long num_bases,long*tindex,long*rindex,char*mdstring,char*read_seq,char*read_qual,char*cs_seq,char*cs_qual,long findex);
-void parse_ins(long num_bases,long*tindex,long*rindex,char*read_seq,char*read_qual,char*cs_seq,char*cs_qual,long findex);
-void parse_del(long num_bases,long*tindex,long*rindex,char*mdstring,char*read_qual,char*cs_seq,char*cs_qual,long findex);
-void parse_clipped(long num_bases,long*rindex,char*read_seq,char*read_qual);
-char*lowercase(char*string);
+void makecs(char aln,long nbases,long*t_index,long*r_index,struct mdcursor*mdtag,char*rseq,char*rqual,char**seqcs,char**qualcs,long targlen);
+void parse_mapped(long num_bases,long*tindex,long*rindex,struct mdcursor*mdc,char*read_seq,char*read_qual,char**cs_seq,char**cs_qual,long findex);
+void parse_ins(long num_bases,long*tindex,long*rindex,char*read_seq,char*read_qual,char**cs_seq,char**cs_qual,long findex);
+void parse_del(long num_bases,long*tindex,long*rindex,struct mdcursor*mdc,char*read_qual,char**cs_seq,char**cs_qual,long findex);
+void parse_clipped(long num_bases,long*rindex);
+void get_windows(gzFile*fasta,struct miptarg*targs,long numtargs);
+void add_window(char*contig,char*seq,long len,struct miptarg*targs,long numtargs);
+void build_armindex(struct armindex*index,struct miptarg*targs,long numtargs,int end);
+long hash_kmer(unsigned int kmer,long size);
+int encode_kmer(char*seq,unsigned int*kmer);
+int getfastq(gzFile*fqgz,struct fastqdata*fread);
+void parsefastq(struct fastqdata*fread,struct miptarg*targs,struct targindex*tindex,struct armindex*starts,struct armindex*ends,struct dpmatrix*dp,gzFile*mseqs,gzFile*unassigned,char*samp,double wigg);
+long assign_read(char*seq,long len,struct miptarg*targs,struct armindex*starts,struct armindex*ends,struct dpmatrix*dp,char*ops,long*cost);
+long extend_match(char*seq,long len,char*ref,long rlen);
+long count_mismatches(char*seq,char*ref,long len,long maxmm);
+long align_window(char*seq,long len,char*ref,long rlen,struct dpmatrix*dp,char*ops);
+long score_ops(char*ops,char*seq,char*ref);
+void revcomp(char*seq,char*rc,long len);
+void aln_cs(char*ops,char*readseq,char*readqual,char*ref,long maploc,long targloc,long targlength,char*csseq,char*csqual);
 
 int main(int argc,char*argv[])
 {
@@ -83,8 +186,72 @@ int main(int argc,char*argv[])
 	//read in information on MIP targets and link MIP targets to guide RNAs
 	get_targ_info(miptargs,targets);
 
-	//get value of mapping location wiggle room from command line
+	//index MIP targets by contig and start coordinate for fast lookup
+	struct targindex tindex;
+	build_targindex(&tindex,targets,ntargs);
+
+	//if the input file contains merged reads, assign reads to MIPs by their arm sequences rather than by mapping location
 	double wiggle=MWIG;
+	long inlen=strlen(*(argv+1));
+	if((inlen>9)&&(strcmp(*(argv+1)+inlen-9,".fastq.gz")==0))
+	{
+		//get value of mapping location wiggle room from command line
+		if(argc==5)
+			wiggle=strtod(*(argv+4),NULL);
+
+		//read in the captured sequence of each MIP target from the genome and index the ends of these sequences
+		gzFile*genome=gzopen(*(argv+3),"r");
+		get_windows(genome,targets,ntargs);
+		gzclose(genome);
+		struct armindex starts,ends;
+		build_armindex(&starts,targets,ntargs,0);
+		build_armindex(&ends,targets,ntargs,1);
+
+		//set up output file for reads which cannot be assigned to MIP targets
+		char unname[NLEN+30];
+		sprintf(unname,"%s_unassigned.fastq.gz",sample);
+		gzFile*unassigned=gzopen(unname,"w");
+
+		//allocate memory for aligning reads to captured sequences
+		struct dpmatrix dp;
+		dp.h=(int*)malloc((SLEN+1)*(SLEN+1)*sizeof(int));
+		dp.e=(int*)malloc((SLEN+1)*(SLEN+1)*sizeof(int));
+		dp.f=(int*)malloc((SLEN+1)*(SLEN+1)*sizeof(int));
+		dp.cands=(long*)malloc(2*ntargs*sizeof(long));
+		dp.exts=(long*)malloc(2*ntargs*sizeof(long));
+
+		//open gzipped fastq file and process reads one by one
+		gzFile*fastq=gzopen(*(argv+1),"r");
+		struct fastqdata fread;
+		while(getfastq(fastq,&fread))
+			parsefastq(&fread,targets,&tindex,&starts,&ends,&dp,mipseqs,unassigned,sample,wiggle);
+
+		//clean up and exit
+		long m;
+		for(m=0;m<ntargs;m++)
+			free(targets[m].window);
+		free(starts.kmers);
+		free(starts.targs);
+		free(ends.kmers);
+		free(ends.targs);
+		free(dp.h);
+		free(dp.e);
+		free(dp.f);
+		free(dp.cands);
+		free(dp.exts);
+		free(tindex.contigs);
+		free(tindex.reps);
+		free(tindex.first);
+		free(tindex.sorted);
+		free(targets);
+		gzclose(mipseqs);
+		gzclose(unassigned);
+		gzclose(fastq);
+		fclose(miptargs);
+		return 0;
+	}
+
+	//get value of mapping location wiggle room from command line
 	if(argc==4)
 		wiggle=strtod(*(argv+3),NULL);
 
@@ -92,9 +259,13 @@ int main(int argc,char*argv[])
 	gzFile*sam=gzopen(*(argv+1),"r");
 	struct readdata read;
 	while(getread(sam,&read))
-		parseread(&read,targets,ntargs,mipseqs,sample,wiggle);
+		parseread(&read,targets,&tindex,mipseqs,sample,wiggle);
 
 	//clean up and exit
+	free(tindex.contigs);
+	free(tindex.reps);
+	free(tindex.first);
+	free(tindex.sorted);
 	free(targets);
 	gzclose(mipseqs);
 	gzclose(sam);
@@ -129,9 +300,10 @@ long count_targs(FILE*mtargs)
 void get_targ_info(FILE*mtargs,struct miptarg*targs)
 {
 	long m=0;
-	while(fscanf(mtargs,"%s %*s %s %ld %*s %c %s %*s %ld %ld",targs[m].name,targs[m].contig,&(targs[m].start),&(targs[m].type),targs[m].crispr,&(targs[m].armlen),&(targs[m].tlength))==7)
+	while(fscanf(mtargs,"%s %*s %s %ld %ld %c %s %*s %ld %ld",targs[m].name,targs[m].contig,&(targs[m].start),&(targs[m].end),&(targs[m].type),targs[m].crispr,&(targs[m].armlen),&(targs[m].tlength))==8)
 	{
 		targs[m].tstart=targs[m].start+targs[m].armlen;
+		targs[m].window=NULL;
 		m++;
 	}	
 	return;
@@ -152,18 +324,10 @@ int getread(gzFile*samgz,struct readdata*reed)
 	return (parsed==7);
 }
 
-void parseread(struct readdata*reed,struct miptarg*targs,long numtargs,gzFile*mseqs,char*samp,double wigg)
+void parseread(struct readdata*reed,struct miptarg*targs,struct targindex*tindex,gzFile*mseqs,char*samp,double wigg)
 {
-	long m=findtarg(reed->contig,reed->maploc,targs,numtargs,wigg);
-	char finalseq[SLEN+1],finalqual[SLEN+1];
-	long i;
-	for(i=0;i<SLEN;i++)
-	{
-		finalseq[i]='\0';
-		finalqual[i]='\0';
-	}
-	finalseq[i]='\0';
-	finalqual[i]='\0';
+	long m=findtarg(reed->contig,reed->maploc,targs,tindex,wigg);
+	char finalseq[3*SLEN+1],finalqual[3*SLEN+1];
 	if(m>=0)
 	{
 		parse_aln(reed->cigar,reed->md,reed->seq,reed->qual,reed->maploc,targs[m].tstart,targs[m].tlength,finalseq,finalqual);
@@ -172,16 +336,108 @@ void parseread(struct readdata*reed,struct miptarg*targs,long numtargs,gzFile*ms
 	return;
 }
 
-long findtarg(char*chr,long coord,struct miptarg*miptargets,long numtargets,double wig)
+void build_targindex(struct targindex*index,struct miptarg*targs,long numtargs)
 {
-	long mnum;
-	for(mnum=0;mnum<numtargets;mnum++)
+	long m,slot,c;
+	index->size=1;
+	while(index->size<2*numtargs) //keep the table at most half full so probe sequences stay short
+		index->size*=2;
+	index->contigs=(long*)malloc(index->size*sizeof(long));
+	index->reps=(long*)malloc((numtargs+1)*sizeof(long));
+	index->sorted=(struct targpos*)malloc((numtargs+1)*sizeof(struct targpos));
+	for(slot=0;slot<index->size;slot++)
+		index->contigs[slot]=-1;
+	index->ncontigs=0;
+	for(m=0;m<numtargs;m++)
 	{
-		if((strncmp(miptargets[mnum].contig,chr,NLEN)==0)&&((coord-wig)<=miptargets[mnum].start)&&((coord+wig)>=miptargets[mnum].start))
-			break;
+		targs[m].contigid=findcontig(targs[m].contig,targs,index);
+		if(targs[m].contigid==-1)
+		{
+			slot=hash_contig(targs[m].contig)&(index->size-1);
+			while(index->contigs[slot]!=-1)
+				slot=(slot+1)&(index->size-1);
+			index->contigs[slot]=index->ncontigs;
+			index->reps[index->ncontigs]=m;
+			targs[m].contigid=index->ncontigs;
+			index->ncontigs++;
+		}
+		index->sorted[m].contigid=targs[m].contigid;
+		index->sorted[m].start=targs[m].start;
+		index->sorted[m].targ=m;
+	}
+	qsort(index->sorted,numtargs,sizeof(struct targpos),compare_targpos);
+	index->first=(long*)malloc((index->ncontigs+1)*sizeof(long));
+	c=0;
+	for(m=0;m<numtargs;m++)
+	{
+		while(c<=index->sorted[m].contigid)
+			index->first[c++]=m;
+	}
+	while(c<=index->ncontigs)
+		index->first[c++]=numtargs;
+	return;
+}
+
+unsigned long hash_contig(char*chr)
+{
+	unsigned long h=14695981039346656037UL; //FNV-1a hash
+	while(*chr!='\0')
+	{
+		h^=(unsigned char)(*chr);
+		h*=1099511628211UL;
+		chr++;
+	}
+	return h;
+}
+
+long findcontig(char*chr,struct miptarg*targs,struct targindex*index)
+{
+	long slot=hash_contig(chr)&(index->size-1);
+	while(index->contigs[slot]!=-1)
+	{
+		if(strncmp(targs[index->reps[index->contigs[slot]]].contig,chr,NLEN)==0)
+			return index->contigs[slot];
+		slot=(slot+1)&(index->size-1);
+	}
+	return -1;
+}
+
+int compare_targpos(const void*a,const void*b)
+{
+	const struct targpos*x=(const struct targpos*)a;
+	const struct targpos*y=(const struct targpos*)b;
+	if(x->contigid!=y->contigid)
+		return (x->contigid<y->contigid)?-1:1;
+	if(x->start!=y->start)
+		return (x->start<y->start)?-1:1;
+	return (x->targ<y->targ)?-1:(x->targ>y->targ);
+}
+
+long findtarg(char*chr,long coord,struct miptarg*miptargets,struct targindex*index,double wig)
+{
+	long c=findcontig(chr,miptargets,index);
+	long lo,hi,mid,mnum=-1;
+	if(c==-1)
+		return -1;
+
+	//find the first MIP target on the contig starting within the wiggle room of the mapping location
+	lo=index->first[c];
+	hi=index->first[c+1];
+	while(lo<hi)
+	{
+		mid=(lo+hi)/2;
+		if((coord-wig)<=index->sorted[mid].start)
+			hi=mid;
+		else
+			lo=mid+1;
+	}
+
+	//if the wiggle room allows more than one MIP target, return the one listed first in the miptargets file
+	for(;(lo<index->first[c+1])&&((coord+wig)>=index->sorted[lo].start);lo++)
+	{
+		if((mnum==-1)||(index->sorted[lo].targ<mnum))
+			mnum=index->sorted[lo].targ;
 	}
-	if(mnum==numtargets)
-		mnum=-1;
 	return mnum;
 }
 
@@ -189,149 +445,171 @@ void parse_aln(char*cigar,char*md,char*readseq,char*readqual,long maploc,long ta
 {
 	long targ_index=maploc-targloc; //target index gives relation of read base to targeted contig bases
 	long read_index=0; //read index gives position in read sequence
-	long cs_index=0; //cs index gives position in output cs-formatted sequence and quality strings
 	long numbases; //number of bases mapped, soft clipped, inserted, or deleted
 	char alignment; //alignment type 'M', 'I', 'D', or 'S'
-	char newcigar[SLEN+1];
-	while(sscanf(cigar,"%ld %c",&numbases,&alignment)==2)
+	char*op=cigar; //position of the next operation in the CIGAR string
+	char*next;
+	struct mdcursor mdc; //position in the MD tag
+	char*cs_seq=csseq; //positions at which to append to the output cs-formatted sequence and quality strings
+	char*cs_qual=csqual;
+	mdc.p=md;
+	mdc.hasnum=0;
+	while(1)
 	{
-		makecs(alignment,numbases,&targ_index,&read_index,md,readseq,readqual,csseq,csqual,targlength);
-		sprintf(newcigar,"%s",strchr(cigar,alignment)+1);
-		strcpy(cigar,newcigar);
+		numbases=strtol(op,&next,10);
+		if(next==op)
+			break;
+		while(isspace(*next))
+			next++;
+		alignment=*next;
+		if(alignment=='\0')
+			break;
+		op=next+1;
+		makecs(alignment,numbases,&targ_index,&read_index,&mdc,readseq,readqual,&cs_seq,&cs_qual,targlength);
 	}
+	*cs_seq='\0';
+	*cs_qual='\0';
 	return;
 }
 
-void makecs(char aln,long nbases,long*t_index,long*r_index,char*mdtag,char*rseq,char*rqual,char*seqcs,char*qualcs,long targlen)
+void makecs(char aln,long nbases,long*t_index,long*r_index,struct mdcursor*mdtag,char*rseq,char*rqual,char**seqcs,char**qualcs,long targlen)
 {
 	switch(aln)
 	{
 		case 'M': parse_mapped(nbases,t_index,r_index,mdtag,rseq,rqual,seqcs,qualcs,targlen-1); break;
 		case 'I':	parse_ins(nbases,t_index,r_index,rseq,rqual,seqcs,qualcs,targlen-1); break;
 		case 'D':	parse_del(nbases,t_index,r_index,mdtag,rqual,seqcs,qualcs,targlen-1); break;
-		case 'S':	parse_clipped(nbases,r_index,rseq,rqual); break;
+		case 'S':	parse_clipped(nbases,r_index); break;
 	}
 	return;
 }
 
-void parse_mapped(long num_bases,long*tindex,long*rindex,char*mdstring,char*read_seq,char*read_qual,char*cs_seq,char*cs_qual,long findex)
+void parse_mapped(long num_bases,long*tindex,long*rindex,struct mdcursor*mdc,char*read_seq,char*read_qual,char**cs_seq,char**cs_qual,long findex)
 {
-	long b,nmatch,base_read,newtract=1;
-	char rbase;
-	char mapseq[4],newmd[SLEN+1];
+	long b,base_read,newtract=1;
+	char*s=*cs_seq;
+	char*q=*cs_qual;
 	for(b=0;b<num_bases;b++)
 	{
 		base_read=0;
-		if(isdigit(mdstring[0]))
+		if((!(mdc->hasnum))&&(isdigit(mdc->p[0])))
+		{
+			mdc->nmatch=strtol(mdc->p,&(mdc->p),10);
+			mdc->hasnum=1;
+		}
+		if(mdc->hasnum)
 		{
-			if(sscanf(mdstring,"%ld %s",&nmatch,newmd)==1)
-				strncpy(newmd,"\0",1);
-			if(nmatch>0)
+			if(mdc->nmatch>0)
 			{
 				if((*tindex>=0)&&(*tindex<=findex))
 				{
 					if(newtract)
 					{
-						strncat(cs_seq,"=",1);
-						strncat(cs_qual,"\"",1);
+						*s++='=';
+						*q++='"';
 						newtract=0;
 					}
-					strncat(cs_seq,read_seq+(*rindex),1);
-					strncat(cs_qual,read_qual+(*rindex),1);
+					*s++=read_seq[*rindex];
+					*q++=read_qual[*rindex];
 				}
 				base_read=1;
-				nmatch--;
-				sprintf(mdstring,"%ld%s",nmatch,newmd);
+				mdc->nmatch--;
 			}
-			if(nmatch==0)
-				strcpy(mdstring,newmd);
-		}		
-		if((isalpha(mdstring[0]))&&(!(base_read)))
+			if(mdc->nmatch==0)
+				mdc->hasnum=0;
+		}
+		if((!(mdc->hasnum))&&(isalpha(mdc->p[0]))&&(!(base_read)))
 		{
-			sscanf(mdstring,"%c %s",&rbase,newmd);
 			if((*tindex>=0)&&(*tindex<=findex))
 			{
-				sprintf(mapseq,"*%c%c",tolower(rbase),tolower(read_seq[*rindex]));
-				strncat(cs_seq,mapseq,3);
-				sprintf(mapseq,"\"%c%c",read_qual[*rindex],read_qual[*rindex]);
-				strncat(cs_qual,mapseq,3);
+				*s++='*';
+				*s++=tolower(mdc->p[0]);
+				*s++=tolower(read_seq[*rindex]);
+				*q++='"';
+				*q++=read_qual[*rindex];
+				*q++=read_qual[*rindex];
 			}
 			newtract=1;
-			strcpy(mdstring,newmd);
+			mdc->p++;
 		}
 		(*tindex)++; //increment index corresponding to target bases
 		(*rindex)++; //increment index corresponding to read bases
 	}
+	*cs_seq=s;
+	*cs_qual=q;
 	return;
 }
 
-void parse_ins(long num_bases,long*tindex,long*rindex,char*read_seq,char*read_qual,char*cs_seq,char*cs_qual,long findex)
+void parse_ins(long num_bases,long*tindex,long*rindex,char*read_seq,char*read_qual,char**cs_seq,char**cs_qual,long findex)
 {
-	char insseq[num_bases+1],insqual[num_bases+1];
-	strncpy(insseq,read_seq+(*rindex),num_bases);
-	strncpy(insqual,read_qual+(*rindex),num_bases);
-	insseq[num_bases]='\0';
-	insqual[num_bases]='\0';
+	long b;
 	if((*tindex>=0)&&(*tindex<=findex))
 	{
-		strncat(cs_seq,"+",1);
-		strncat(cs_seq,lowercase(insseq),strlen(insseq));
-		strncat(cs_qual,"\"",1);
-		strncat(cs_qual,insqual,strlen(insqual));		
+		*(*cs_seq)++='+';
+		*(*cs_qual)++='"';
+		for(b=0;b<num_bases;b++)
+		{
+			*(*cs_seq)++=tolower(read_seq[*rindex+b]);
+			*(*cs_qual)++=read_qual[*rindex+b];
+		}
 	}
 	(*rindex)+=num_bases; //increment index corresponding to read bases only
 	return;
 }
 
-void parse_del(long num_bases,long*tindex,long*rindex,char*mdstring,char*read_qual,char*cs_seq,char*cs_qual,long findex)
+void parse_del(long num_bases,long*tindex,long*rindex,struct mdcursor*mdc,char*read_qual,char**cs_seq,char**cs_qual,long findex)
 {
-	char delseq[num_bases+1],delqual[num_bases+1],newmd[SLEN+1];
-	strncpy(delseq,mdstring+1,num_bases);
-	delseq[num_bases]='\0';
-	delqual[num_bases]='\0';
-	long b;
-	for(b=0;b<num_bases;b++)
+	long b,first=-1,ndel=0;
+	char delqual=(read_qual[*rindex-1]+read_qual[*rindex])/2;
+
+	//a count of matching bases not yet used up is written back in front of the rest of the MD tag, as the deleted bases are expected at its start
+	if(mdc->hasnum)
+	{
+		sprintf(mdc->buf,"%ld%s",mdc->nmatch,mdc->p);
+		mdc->p=mdc->buf;
+		mdc->hasnum=0;
+	}
+
+	//only deleted bases within the target are annotated
+	for(b=0;(b<num_bases)&&(mdc->p[b+1]!='\0');b++)
 	{
-		if((*tindex<0)||(*tindex>findex))
+		if((*tindex>=0)&&(*tindex<=findex))
 		{
-			delseq[b]='\t';
-			delqual[b]='\t';
+			if(first==-1)
+				first=b;
+			ndel++;
 		}
-		else
-			delqual[b]=(read_qual[*rindex-1]+read_qual[*rindex])/2;
 		(*tindex)++; //increment index corresponding to target bases only
-	}	
-	if((sscanf(delseq,"%s",delseq)==1)&&(sscanf(delqual,"%s",delqual)==1))
+	}
+	for(;b<num_bases;b++)
+		(*tindex)++;
+	if(ndel>0)
 	{
-		strncat(cs_seq,"-",1);
-		strncat(cs_seq,lowercase(delseq),strlen(delseq));
-		strncat(cs_qual,"\"",1);
-		strncat(cs_qual,delqual,strlen(delqual));
+		*(*cs_seq)++='-';
+		*(*cs_qual)++='"';
+		for(b=first;b<first+ndel;b++)
+		{
+			*(*cs_seq)++=tolower(mdc->p[b+1]);
+			*(*cs_qual)++=delqual;
+		}
+		mdc->p+=ndel+1; //as in earlier versions of this program, only the annotated deleted bases are skipped over in the MD tag
 	}
-	sprintf(newmd,"%s",mdstring+strlen(delseq)+1);
-	strcpy(mdstring,newmd);
-	return;	
-}
-
-void parse_clipped(long num_bases,long*rindex,char*read_seq,char*read_qual)
-{
-	long b;
-	for(b=0;b<num_bases;b++)
-		(*rindex)++;
+	else
+		mdc->p+=strnlen(mdc->p,num_bases+1);
 	return;
 }
 
-char*lowercase(char*string)
+void parse_clipped(long num_bases,long*rindex)
 {
-	long i;
-	for(i=0;i<strlen(string);i++)
-		string[i]=tolower(string[i]);
-	return string;
+	(*rindex)+=num_bases;
+	return;
 }
 
-//parse_aln, makecs, parse_mapped, parse_ins, parse_del, parse_clipped, and lowercase are functions to parse through CIGAR string and MD tag
+//parse_aln, makecs, parse_mapped, parse_ins, parse_del, and parse_clipped are functions to parse through CIGAR string and MD tag
 //corresponding to a single read, generating a new sequence string in cs format and a corresponding new quality string; these strings can be
-//easily parsed to quickly analyze the alignment of the read to the reference sequence it mapped to for SNV mutations and indels
+//easily parsed to quickly analyze the alignment of the read to the reference sequence it mapped to for SNV mutations and indels; the
+//CIGAR string and MD tag are each read once from start to end, and the output strings are appended to in place, so annotating a read
+//takes time proportional to its length
 //
 //see https://github.com/lh3/minimap2#cs for details of the cs format; this program annotates the alignment using the cs long format
 //
@@ -340,3 +618,544 @@ char*lowercase(char*string)
 //this code has been tested on several gzipped sam inputs and reproducibly outputs annotated sequences equivalent to those produced using the
 //parse_cigar_and_md function from my old MIP sequence annotation program used to analyze SRGAP2 MIP sequence data
 
+
+void get_windows(gzFile*fasta,struct miptarg*targs,long numtargs)
+{
+	char line[LLEN],contig[NLEN+1];
+	char*seq=NULL;
+	long len=0,size=0,l;
+	contig[0]='\0';
+	while(gzgets(fasta,line,LLEN-1))
+	{
+		if(line[0]=='>')
+		{
+			if(contig[0]!='\0')
+				add_window(contig,seq,len,targs,numtargs);
+			sscanf(line+1,"%200s",contig);
+			len=0;
+			continue;
+		}
+		for(l=0;(line[l]!='\0')&&(line[l]!='\n')&&(line[l]!='\r');l++)
+		{
+			if(len==size)
+			{
+				size=(size==0)?1048576:2*size;
+				seq=(char*)realloc(seq,size);
+			}
+			seq[len]=toupper(line[l]);
+			len++;
+		}
+	}
+	if(contig[0]!='\0')
+		add_window(contig,seq,len,targs,numtargs);
+	free(seq);
+	return;
+}
+
+void add_window(char*contig,char*seq,long len,struct miptarg*targs,long numtargs)
+{
+	long m,wlen;
+	for(m=0;m<numtargs;m++)
+	{
+		if((strncmp(targs[m].contig,contig,NLEN)!=0)||(targs[m].start<1)||(targs[m].end>len)||(targs[m].end<targs[m].start))
+			continue;
+		wlen=targs[m].end-targs[m].start+1;
+		targs[m].window=(char*)malloc(wlen+1);
+		strncpy(targs[m].window,seq+targs[m].start-1,wlen);
+		targs[m].window[wlen]='\0';
+	}
+	return;
+}
+
+void build_armindex(struct armindex*index,struct miptarg*targs,long numtargs,int end)
+{
+	long m,slot,wlen;
+	unsigned int kmer;
+	index->size=1;
+	while(index->size<2*numtargs) //keep the table at most half full so probe sequences stay short
+		index->size*=2;
+	index->kmers=(unsigned int*)malloc(index->size*sizeof(unsigned int));
+	index->targs=(long*)malloc(index->size*sizeof(long));
+	for(slot=0;slot<index->size;slot++)
+		index->targs[slot]=-1;
+	for(m=0;m<numtargs;m++)
+	{
+		if(targs[m].window==NULL)
+			continue;
+		wlen=targs[m].end-targs[m].start+1;
+		if((wlen<KLEN)||(!encode_kmer(end?(targs[m].window+wlen-KLEN):targs[m].window,&kmer)))
+			continue;
+		slot=hash_kmer(kmer,index->size);
+		while(index->targs[slot]!=-1)
+			slot=(slot+1)&(index->size-1);
+		index->kmers[slot]=kmer;
+		index->targs[slot]=m;
+	}
+	return;
+}
+
+long hash_kmer(unsigned int kmer,long size)
+{
+	return (long)((kmer*11400714819323198485UL)>>32)&(size-1); //multiplicative (Fibonacci) hash
+}
+
+int encode_kmer(char*seq,unsigned int*kmer)
+{
+	int i;
+	*kmer=0;
+	for(i=0;i<KLEN;i++)
+	{
+		switch(seq[i])
+		{
+			case 'A': *kmer=(*kmer<<2); break;
+			case 'C': *kmer=(*kmer<<2)|1; break;
+			case 'G': *kmer=(*kmer<<2)|2; break;
+			case 'T': *kmer=(*kmer<<2)|3; break;
+			default: return 0;
+		}
+	}
+	return 1;
+}
+
+int getfastq(gzFile*fqgz,struct fastqdata*fread)
+{
+	char line[LLEN];
+	char*tag;
+	if(!gzgets(fqgz,fread->name,LLEN-1))
+		return 0;
+	if(!gzgets(fqgz,line,LLEN-1))
+		return 0;
+	strncpy(fread->seq,line,SLEN);
+	fread->seq[SLEN]='\0';
+	fread->seq[strcspn(fread->seq,"\r\n")]='\0';
+	gzgets(fqgz,line,LLEN-1);
+	if(!gzgets(fqgz,line,LLEN-1))
+		return 0;
+	strncpy(fread->qual,line,SLEN);
+	fread->qual[SLEN]='\0';
+	fread->qual[strcspn(fread->qual,"\r\n")]='\0';
+	fread->length=strlen(fread->seq);
+	fread->tag[0]='\0';
+	tag=strstr(fread->name,"MI:Z:$");
+	if(tag!=NULL)
+	{
+		strncpy(fread->tag,tag+6,TLEN);
+		fread->tag[TLEN]='\0';
+	}
+	return 1;
+}
+
+void parsefastq(struct fastqdata*fread,struct miptarg*targs,struct targindex*tindex,struct armindex*starts,struct armindex*ends,struct dpmatrix*dp,gzFile*mseqs,gzFile*unassigned,char*samp,double wigg)
+{
+	char rcseq[SLEN+1],rcqual[SLEN+1],ops[2*SLEN+1],rcops[2*SLEN+1],finalseq[3*SLEN+1],finalqual[3*SLEN+1];
+	char*seq=fread->seq;
+	char*qual=fread->qual;
+	char*alnops=ops;
+	long len=fread->length;
+	long c,rc,m,i,cost,rccost;
+
+	//try to assign the read and its reverse complement to a MIP target, keeping whichever aligns best to the MIP's captured sequence
+	c=assign_read(fread->seq,len,targs,starts,ends,dp,ops,&cost);
+	revcomp(fread->seq,rcseq,len);
+	rc=assign_read(rcseq,len,targs,starts,ends,dp,rcops,&rccost);
+	if((rc!=-1)&&((c==-1)||(rccost<cost)))
+	{
+		c=rc;
+		seq=rcseq;
+		for(i=0;i<len;i++)
+			rcqual[i]=fread->qual[len-1-i];
+		rcqual[len]='\0';
+		qual=rcqual;
+		alnops=rcops;
+	}
+	if(c==-1)
+	{
+		gzprintf(unassigned,"%s%s\n+\n%s\n",fread->name,fread->seq,fread->qual);
+		return;
+	}
+
+	//report the read at the MIP target a read mapped to the start of the captured sequence would be assigned to
+	m=findtarg(targs[c].contig,targs[c].start,targs,tindex,wigg);
+	aln_cs(alnops,seq,qual,targs[c].window,targs[c].start,targs[m].tstart,targs[m].tlength,finalseq,finalqual);
+	gzprintf(mseqs,"%s\t%s\t%c\t%s\t%s\t%ld\t%s\t%s\t%s\n",samp,targs[m].name,targs[m].type,targs[m].crispr,targs[m].contig,targs[m].tstart,finalseq,finalqual,fread->tag);
+	return;
+}
+
+long assign_read(char*seq,long len,struct miptarg*targs,struct armindex*starts,struct armindex*ends,struct dpmatrix*dp,char*ops,long*cost)
+{
+	struct armindex*index[2]={starts,ends};
+	char candops[2*SLEN+1];
+	long maxdiff=(long)(len*MAXMMFRAC);
+	long best=-1,ncands=0,maxext=0,slot,t,wlen,diff,c,i;
+	unsigned int kmer;
+	int e,hit,goodstart=0;
+	*cost=len+1;
+	if(len<KLEN)
+		return -1;
+
+	//find candidate MIPs by the first and last bases of the read; reads as long as a candidate's captured sequence are first compared to it without gaps
+	for(e=0;e<2;e++)
+	{
+		if(!encode_kmer(e?(seq+len-KLEN):seq,&kmer))
+			continue;
+		if(e==0)
+			goodstart=1;
+		slot=hash_kmer(kmer,index[e]->size);
+		while(index[e]->targs[slot]!=-1)
+		{
+			t=index[e]->targs[slot];
+			hit=(index[e]->kmers[slot]==kmer);
+			slot=(slot+1)&(index[e]->size-1);
+			if(!hit)
+				continue;
+			if((e==1)&&(goodstart)&&(strncmp(seq,targs[t].window,KLEN)==0))
+				continue; //candidate already found by the first bases of the read
+			wlen=targs[t].end-targs[t].start+1;
+			if(wlen==len)
+			{
+				diff=count_mismatches(seq,targs[t].window,len,maxdiff);
+				if((diff<=maxdiff)&&((diff<(*cost))||((diff==(*cost))&&(t<best))))
+				{
+					best=t;
+					*cost=diff;
+				}
+			}
+			if((labs(wlen-len)<=BAND)&&(wlen<=SLEN))
+			{
+				dp->cands[ncands]=t;
+				dp->exts[ncands]=extend_match(seq,len,targs[t].window,wlen);
+				if(dp->exts[ncands]>maxext)
+					maxext=dp->exts[ncands];
+				ncands++;
+			}
+		}
+	}
+	if(best!=-1)
+	{
+		for(i=0;i<len;i++)
+			ops[i]='M';
+		ops[len]='\0';
+
+		//a run of mismatches may instead be a deletion and a nearby compensating insertion (or vice versa), so such reads are also aligned with gaps, keeping whichever alignment scores better
+		if(*cost>GAPLESSMM)
+		{
+			diff=align_window(seq,len,targs[best].window,len,dp,candops);
+			if((diff<=maxdiff)&&(score_ops(candops,seq,targs[best].window)>score_ops(ops,seq,targs[best].window)))
+			{
+				*cost=diff;
+				strcpy(ops,candops);
+			}
+		}
+		return best;
+	}
+
+	//otherwise, align the read to the captured sequences of the candidates it matches best from either end without gaps, as many MIPs share arm sequences
+	for(c=0;c<ncands;c++)
+	{
+		if(dp->exts[c]<maxext-EXTSLACK)
+			continue;
+		t=dp->cands[c];
+		diff=align_window(seq,len,targs[t].window,targs[t].end-targs[t].start+1,dp,candops);
+		if((diff<=maxdiff)&&((diff<(*cost))||((diff==(*cost))&&(t<best))))
+		{
+			best=t;
+			*cost=diff;
+			strcpy(ops,candops);
+		}
+	}
+	return best;
+}
+
+long extend_match(char*seq,long len,char*ref,long rlen)
+{
+	long i,mm,ext=0;
+	long maxlen=(len<rlen)?len:rlen;
+
+	//count the bases matched from the start of the read, and then from the end, before a second mismatch is found
+	for(i=0,mm=0;(i<maxlen)&&(mm<2);i++)
+	{
+		if(seq[i]!=ref[i])
+			mm++;
+	}
+	ext+=i;
+	for(i=0,mm=0;(i<maxlen)&&(mm<2);i++)
+	{
+		if(seq[len-1-i]!=ref[rlen-1-i])
+			mm++;
+	}
+	ext+=i;
+	return ext;
+}
+
+long count_mismatches(char*seq,char*ref,long len,long maxmm)
+{
+	long i=0,mm=0;
+#ifdef __SSE2__
+	//compare 16 bases at a time, stopping early once too many mismatches are found
+	__m128i vs,vr;
+	for(;i+16<=len;i+=16)
+	{
+		vs=_mm_loadu_si128((__m128i*)(seq+i));
+		vr=_mm_loadu_si128((__m128i*)(ref+i));
+		mm+=16-__builtin_popcount(_mm_movemask_epi8(_mm_cmpeq_epi8(vs,vr)));
+		if(mm>maxmm)
+			return mm;
+	}
+#endif
+	for(;(i<len)&&(mm<=maxmm);i++)
+	{
+		if(seq[i]!=ref[i])
+			mm++;
+	}
+	return mm;
+}
+
+long align_window(char*seq,long len,char*ref,long rlen,struct dpmatrix*dp,char*ops)
+{
+	long cols=rlen+1;
+	long dlo=((rlen<len)?(rlen-len):0)-BAND; //lowest diagonal (j-i) within the band
+	long dhi=((rlen>len)?(rlen-len):0)+BAND; //highest diagonal (j-i) within the band
+	long i,j,jlo,jhi,k,n=0,diff=0;
+	int s,state=0;
+	int*H=dp->h;
+	int*E=dp->e;
+	int*F=dp->f;
+
+	//fill in the banded dynamic programming matrices for global alignment with affine gap penalties (E: deletions from the read, F: insertions in the read)
+	H[0]=0;
+	E[0]=F[0]=NEGINF;
+	for(j=1;(j<=rlen)&&(j<=dhi);j++)
+	{
+		H[j]=E[j]=-(GAPO+j*GAPE);
+		F[j]=NEGINF;
+	}
+	if(j<=rlen)
+		H[j]=E[j]=F[j]=NEGINF;
+	for(i=1;i<=len;i++)
+	{
+		jlo=(i+dlo>0)?(i+dlo):0;
+		jhi=(i+dhi<rlen)?(i+dhi):rlen;
+		if(jlo>0)
+			H[i*cols+jlo-1]=E[i*cols+jlo-1]=F[i*cols+jlo-1]=NEGINF;
+		for(j=jlo;j<=jhi;j++)
+		{
+			k=i*cols+j;
+			if(j==0)
+			{
+				H[k]=F[k]=-(GAPO+i*GAPE);
+				E[k]=NEGINF;
+				continue;
+			}
+			E[k]=((H[k-1]-GAPO-GAPE)>(E[k-1]-GAPE))?(H[k-1]-GAPO-GAPE):(E[k-1]-GAPE);
+			F[k]=((H[k-cols]-GAPO-GAPE)>(F[k-cols]-GAPE))?(H[k-cols]-GAPO-GAPE):(F[k-cols]-GAPE);
+			s=((seq[i-1]=='N')||(ref[j-1]=='N'))?-1:((seq[i-1]==ref[j-1])?MATCH:-MISMATCH);
+			H[k]=H[k-cols-1]+s;
+			if(E[k]>H[k])
+				H[k]=E[k];
+			if(F[k]>H[k])
+				H[k]=F[k];
+		}
+		if(jhi<rlen)
+			H[i*cols+jhi+1]=E[i*cols+jhi+1]=F[i*cols+jhi+1]=NEGINF;
+	}
+
+	//trace back from the end of both sequences, preferring matches and mismatches to gaps so that gaps are placed as far left as possible
+	i=len;
+	j=rlen;
+	while((i>0)||(j>0))
+	{
+		k=i*cols+j;
+		if(state==0)
+		{
+			if((i>0)&&(j>0)&&(H[k]==H[k-cols-1]+(((seq[i-1]=='N')||(ref[j-1]=='N'))?-1:((seq[i-1]==ref[j-1])?MATCH:-MISMATCH))))
+			{
+				ops[n++]='M';
+				if(seq[i-1]!=ref[j-1])
+					diff++;
+				i--;
+				j--;
+			}
+			else if((j>0)&&(H[k]==E[k]))
+				state=1;
+			else
+				state=2;
+		}
+		else if(state==1)
+		{
+			ops[n++]='D';
+			if((j==1)||(E[k]==H[k-1]-GAPO-GAPE))
+			{
+				state=0;
+				diff++;
+			}
+			j--;
+		}
+		else
+		{
+			ops[n++]='I';
+			if((i==1)||(F[k]==H[k-cols]-GAPO-GAPE))
+			{
+				state=0;
+				diff++;
+			}
+			i--;
+		}
+	}
+	for(k=0;k<n/2;k++)
+	{
+		s=ops[k];
+		ops[k]=ops[n-1-k];
+		ops[n-1-k]=s;
+	}
+	ops[n]='\0';
+	return diff;
+}
+
+long score_ops(char*ops,char*seq,char*ref)
+{
+	long score=0,r=0,t=0;
+	char gap;
+
+	//score an alignment of a read to a captured sequence as align_window does (bwa mem's default scores, with bases matched to an N scoring -1)
+	while(*ops!='\0')
+	{
+		if(*ops=='M')
+		{
+			score+=((seq[r]=='N')||(ref[t]=='N'))?-1:((seq[r]==ref[t])?MATCH:-MISMATCH);
+			r++;
+			t++;
+			ops++;
+		}
+		else
+		{
+			score-=GAPO;
+			gap=*ops;
+			while(*ops==gap)
+			{
+				score-=GAPE;
+				if(*ops=='I')
+					r++;
+				else
+					t++;
+				ops++;
+			}
+		}
+	}
+	return score;
+}
+
+void revcomp(char*seq,char*rc,long len)
+{
+	long p;
+	for(p=0;p<len;p++)
+	{
+		switch(seq[len-1-p])
+		{
+			case 'A': rc[p]='T'; break;
+			case 'C': rc[p]='G'; break;
+			case 'G': rc[p]='C'; break;
+			case 'T': rc[p]='A'; break;
+			default: rc[p]='N';
+		}
+	}
+	rc[len]='\0';
+	return;
+}
+
+void aln_cs(char*ops,char*readseq,char*readqual,char*ref,long maploc,long targloc,long targlength,char*csseq,char*csqual)
+{
+	long tindex=maploc-targloc; //target index gives relation of read base to targeted contig bases
+	long r=0,t=0; //positions in read and captured sequence
+	int newtract=1,started;
+	char*s=csseq;
+	char*q=csqual;
+	while(*ops!='\0')
+	{
+		switch(*ops)
+		{
+			case 'M':
+				if(readseq[r]==ref[t])
+				{
+					if((tindex>=0)&&(tindex<targlength))
+					{
+						if(newtract)
+						{
+							*s++='=';
+							*q++='"';
+							newtract=0;
+						}
+						*s++=readseq[r];
+						*q++=readqual[r];
+					}
+				}
+				else
+				{
+					if((tindex>=0)&&(tindex<targlength))
+					{
+						*s++='*';
+						*s++=tolower(ref[t]);
+						*s++=tolower(readseq[r]);
+						*q++='"';
+						*q++=readqual[r];
+						*q++=readqual[r];
+					}
+					newtract=1;
+				}
+				r++;
+				t++;
+				tindex++;
+				ops++;
+				break;
+			case 'I':
+				if((tindex>=0)&&(tindex<targlength))
+				{
+					*s++='+';
+					*q++='"';
+					while(*ops=='I')
+					{
+						*s++=tolower(readseq[r]);
+						*q++=readqual[r];
+						r++;
+						ops++;
+					}
+				}
+				while(*ops=='I')
+				{
+					r++;
+					ops++;
+				}
+				newtract=1;
+				break;
+			case 'D':
+				started=0;
+				while(*ops=='D')
+				{
+					if((tindex>=0)&&(tindex<targlength))
+					{
+						if(!started)
+						{
+							*s++='-';
+							*q++='"';
+							started=1;
+						}
+						*s++=tolower(ref[t]);
+						*q++=(readqual[(r>0)?(r-1):r]+readqual[(readqual[r]!='\0')?r:(r-1)])/2;
+					}
+					t++;
+					tindex++;
+					ops++;
+				}
+				newtract=1;
+				break;
+		}
+	}
+	*s='\0';
+	*q='\0';
+	return;
+}
+
+//get_windows, build_armindex, assign_read, align_window, and aln_cs are functions to assign merged reads to MIP targets without mapping
+//and to annotate them; a read is aligned to the captured sequence of its MIP (first without gaps, then if needed with a banded global
+//alignment using bwa mem's default scores), and its cs-formatted sequence and quality strings are generated directly from the alignment,
+//following the same conventions as parse_aln does for a read mapped to the start of the captured sequence (e.g., "*ag" for a mismatch, with
+//the read base quality given twice, and deleted bases given the mean quality of the read bases on either side)
@@ -2,18 +2,26 @@
 
 #Xander Nuttle
 #prep_fastqs.sh
-#Call: /data/talkowski/xander/MIPs/analysis_programs/prep_fastqs.sh sampleset_name merging_input_directory molecular_tag_length
+#Call: /data/talkowski/xander/MIPs/analysis_programs/prep_fastqs.sh sampleset_name merging_input_directory molecular_tag_length <miptargets_file>
+#
+#The sampleset's barcodekey file may list a single sample (as generated by set_up_demultiplexed_fastqs.sh) or every sample from an undemultiplexed
+#run (as generated by set_up_undemultiplexed_fastqs.sh), in which case the run's fastq files are decompressed once and each sample's output
+#files are moved to the merging input directory.
+#
+#If a miptargets file (full path) is given, read pairs are merged during fastq prep and merged reads (*_FS1_M*.fastq.gz) are moved to the
+#merging input directory, so the PEAR jobs (makejob_pear.sh) can be skipped and that directory used as the mapping input directory.
 
 REFERENCE_DIR=/var/tmp/xnuttle
 CURRENT_DIR=$(pwd)
-SAMPLE=$(cut -f1 ${1}.barcodekey)
 
 mkdir -p $REFERENCE_DIR
 chgrp -R miket $REFERENCE_DIR
 chmod -R g+wx $REFERENCE_DIR
 rsync -a --bwlimit=500 $CURRENT_DIR/$1* $REFERENCE_DIR
 cd $REFERENCE_DIR
-/data/talkowski/xander/MIPs/analysis_programs/dm_fastq_to_fastq_for_pear ${1}.r1.fastq.gz ${1}.bc1.fastq.gz ${1}.bc2.fastq.gz ${1}.r2.fastq.gz 142 $3 250000 ${1}.barcodekey
-mv $REFERENCE_DIR/${SAMPLE}_FS*fastq.gz $2
+/data/talkowski/xander/MIPs/analysis_programs/dm_fastq_to_fastq_for_pear ${1}.r1.fastq.gz ${1}.bc1.fastq.gz ${1}.bc2.fastq.gz ${1}.r2.fastq.gz 142 $3 250000 ${1}.barcodekey $4
+for SAMPLE in $(cut -f1 ${1}.barcodekey); do
+	mv $REFERENCE_DIR/${SAMPLE}_FS*fastq.gz $2
+done
 rm $REFERENCE_DIR/$1*
 
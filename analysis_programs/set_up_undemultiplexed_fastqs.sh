@@ -0,0 +1,29 @@
+#Xander Nuttle
+#set_up_undemultiplexed_fastqs.sh
+#Call: bash /data/talkowski/xander/MIPs/analysis_programs/set_up_undemultiplexed_fastqs.sh barcodekey_file datadir_file
+#
+#Differs from set_up_demultiplexed_fastqs.sh in that the sequencing run was delivered as a single set of undemultiplexed gzipped fastq
+#files (one file each of first reads, index1 reads, index2 reads, and second reads) rather than as separate files for each sample.
+#
+#Creates soft links to the undemultiplexed fastq files (run.r1, run.bc1, run.bc2, and run.r2). Also generates a barcodekey file listing
+#every sample (run.barcodekey) and a file listing this single set (samplesets.txt). A single fastq prep job then decompresses the run
+#once, extracting molecular tags and routing each read pair whose index reads perfectly match a sample's barcodes to that sample's output
+#files. For runs using only single indexing, there is no index2 file to link, and makejob_fastq_prep_si.sh should be used to set up the
+#fastq prep job. The input "barcodekey_file" is a tab-delimited file listing sample names in column 1, index barcodes in column 2, and
+#(for dual indexing) index2 barcodes in column 3. The datadir file is a text file containing the path to the directory containing the
+#original undemultiplexed gzipped fastq files.
+
+datadir=$(cat $2)
+setname="run"
+fastq1=`ls $datadir|grep '\.1\.fastq'`
+fastq2=`ls $datadir|grep '\.barcode_1\.fastq'`
+fastq3=`ls $datadir|grep '\.barcode_2\.fastq'`
+fastq4=`ls $datadir|grep '\.2\.fastq'`
+ln -s $datadir/$fastq1 ${setname}.r1.fastq.gz
+ln -s $datadir/$fastq2 ${setname}.bc1.fastq.gz
+if [ -n "$fastq3" ]; then
+	ln -s $datadir/$fastq3 ${setname}.bc2.fastq.gz
+fi
+ln -s $datadir/$fastq4 ${setname}.r2.fastq.gz
+awk -F '\t' '{print $1"\t"$2$3}' $1 > ${setname}.barcodekey
+echo $setname > samplesets.txt